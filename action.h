@@ -63,13 +63,17 @@ class action::slide : public action {
 public:
 	static constexpr unsigned type = type_flag('s');
 	slide(unsigned oper) : action(slide::type | (oper & 0b11)) {}
+	slide(unsigned oper, unsigned depth) : action(slide::type | (oper & 0b11) | ((depth & 0xff) << 2)) {}
 	slide(const action& a = {}) : action(a) {}
+	unsigned depth() const { return (event() >> 2) & 0xff; } // the search depth reached, or 0 if not searched
 public:
 	board::reward apply(board& b) const {
 		return b.slide(event());
 	}
 	std::ostream& operator >>(std::ostream& out) const {
-		return out << '#' << ("URDL")[event() & 0b11];
+		out << '#' << ("URDL")[event() & 0b11];
+		if (depth()) out << '{' << std::dec << depth() << '}';
+		return out;
 	}
 	std::istream& operator <<(std::istream& in) {
 		if (in.peek() == '#' && in) {
@@ -78,7 +82,13 @@ public:
 			const char* opc = "URDL";
 			unsigned oper = std::find(opc, opc + 4, v) - opc;
 			if (oper < 4) {
-				operator= (action::slide(oper));
+				unsigned depth = 0;
+				if (in.peek() == '{') {
+					in.ignore(1);
+					in >> std::dec >> depth;
+					in.ignore(1);
+				}
+				operator= (action::slide(oper, depth));
 				return in;
 			}
 		}
@@ -13,12 +13,28 @@
 #include <random>
 #include <sstream>
 #include <map>
+#include <unordered_map>
+#include <iterator>
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "scheduler.h"
+#include "transposition.h"
+#include "book.h"
+#include "trajectory.h"
 
 class agent {
 public:
@@ -36,6 +52,12 @@ public:
 	virtual action take_action(const board& b) { return action(); }
 	virtual bool check_for_win(const board& b) { return false; }
 
+	/**
+	 * write and read the state needed to resume a run exactly, e.g., random engines
+	 */
+	virtual void save_state(std::ostream& out) const {}
+	virtual void load_state(std::istream& in) {}
+
 public:
 	virtual std::string property(const std::string& key) const { return meta.at(key); }
 	virtual void notify(const std::string& msg) { meta[msg.substr(0, msg.find('='))] = { msg.substr(msg.find('=') + 1) }; }
@@ -63,9 +85,14 @@ public:
 	random_agent(const std::string& args = "") : agent(args) {
 		if (meta.find("seed") != meta.end())
 			engine.seed(int(meta["seed"]));
+		if (meta.find("thread") != meta.end()) // workers of a parallel run draw different streams
+			engine.seed((meta.find("seed") != meta.end() ? int(meta["seed"]) : 0) + int(meta["thread"]));
 	}
 	virtual ~random_agent() {}
 
+	virtual void save_state(std::ostream& out) const { out << engine << std::endl; }
+	virtual void load_state(std::istream& in) { in >> engine; }
+
 protected:
 	std::default_random_engine engine;
 };
@@ -76,6 +103,12 @@ protected:
 class weight_agent : public agent {
 public:
 	weight_agent(const std::string& args = "") : agent(args), alpha(0.0125) {
+		if (meta.find("numa") != meta.end()) // "interleave" or "replicate", both spread the primary network across nodes
+			placement = numa::placement(numa::interleave);
+		for (unsigned t = 0; t < 16; t++)
+			alphabet[t] = t;
+		if (meta.find("alphabet") != meta.end()) // e.g., "alphabet=13" maps the tiles from index 12 on to one symbol
+			clamp_alphabet(int(meta["alphabet"]));
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
@@ -88,38 +121,195 @@ public:
 			save_weights(meta["save"]);
 	}
 
+public:
+	/**
+	 * write the weights to a file, e.g., for a checkpoint of a run
+	 */
+	void snapshot(const std::string& path) {
+		save_weights(path);
+	}
+
+	/**
+	 * work on the network of another agent, e.g., as a worker running on the n-th node
+	 * with "numa=replicate" and alpha=0, the worker reads a replica local to its node instead
+	 */
+	virtual void share_weights(const weight_agent& src, size_t node = 0) {
+		if (meta.find("numa") != meta.end() && std::string(meta["numa"]) == "replicate" && alpha == 0)
+			net = src.replica(node);
+		else
+			net = src.net;
+		alphabet = src.alphabet;
+		layout = src.layout;
+	}
+
+	/**
+	 * the number of symbols of the alphabet, i.e., the radix of tuple indices
+	 */
+	unsigned radix() const {
+		return *std::max_element(alphabet.begin(), alphabet.end()) + 1u;
+	}
+
+	/**
+	 * whether every tile is its own symbol, i.e., the indices are the tiles, 4 bits each
+	 */
+	bool plain_alphabet() const {
+		for (unsigned t = 0; t < 16; t++)
+			if (alphabet[t] != t) return false;
+		return true;
+	}
+
+protected:
+	std::vector<weight> replica(size_t node) const {
+		std::lock_guard<std::mutex> lock(replica_mutex);
+		std::vector<weight>& rep = replicas[node];
+		if (rep.empty())
+			for (const weight& w : net) rep.emplace_back(w, numa::placement(numa::bind, node));
+		return rep;
+	}
+
 protected:
 	virtual void init_weights(const std::string& info) {
 		std::string res = info; // comma-separated sizes, e.g., "65536,65536"
 		for (char& ch : res)
 			if (!std::isdigit(ch)) ch = ' ';
 		std::stringstream in(res);
-		for (size_t size; in >> size; net.emplace_back(size)){
+		if (meta.find("sparse") != meta.end()) {
+			// hash-backed tables holding at most 'sparse' entries each, e.g., "sparse=4194304"
+			size_t cap = meta["sparse"];
+			for (size_t size; in >> size; net.emplace_back(size, cap, placement));
+			return;
+		}
+		for (size_t size; in >> size; net.emplace_back(size, placement)){
 			//test
 			//printf("%lu\n",size);
 		}
 	}
+	/**
+	 * map each tile to a symbol, where the tiles from index n-1 on share the last symbol
+	 */
+	void clamp_alphabet(unsigned n) {
+		if (n < 2 || n > 16) std::exit(-1);
+		for (unsigned t = 0; t < 16; t++)
+			alphabet[t] = std::min(t, n - 1);
+	}
+	/**
+	 * read the records following the tables (see save_weights); the alphabet saved with the weights
+	 * must agree with the "alphabet" argument if any
+	 */
+	void load_trailers(const char* at, const char* end) {
+		while (end - at >= 4) {
+			if (std::memcmp(at, "TAB1", 4) == 0 && end - at >= 20) {
+				std::array<uint8_t, 16> saved;
+				std::memcpy(saved.data(), at + 4, saved.size());
+				if (meta.find("alphabet") != meta.end() && saved != alphabet) std::exit(-1);
+				alphabet = saved;
+				at += 20;
+			} else if (std::memcmp(at, "TLO1", 4) == 0 && end - at >= 8) {
+				uint32_t num = 0;
+				std::memcpy(&num, at + 4, sizeof(num));
+				at += 8;
+				layout.assign(num, {});
+				for (auto& order : layout) {
+					if (at >= end || end - at - 1 < uint8_t(*at)) std::exit(-1);
+					order.assign(at + 1, at + 1 + uint8_t(*at));
+					at += 1 + order.size();
+				}
+			} else {
+				break;
+			}
+		}
+	}
 	virtual void load_weights(const std::string& path) {
+		if (meta.find("map") != meta.end() && placement.mode == numa::none && map_weights(path)) return;
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
 		uint32_t size;
 		in.read(reinterpret_cast<char*>(&size), sizeof(size));
 		net.resize(size);
 		for (weight& w : net) in >> w;
+		std::string rest((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		load_trailers(rest.data(), rest.data() + rest.size());
 		in.close();
+		if (placement.mode != numa::none)
+			for (weight& w : net) w = weight(w, placement);
 	}
+	/**
+	 * map the dense tables of a file copy-on-write instead of reading them, so that pages
+	 * are read on demand; returns false for files with sparse tables, which are read as usual
+	 * this is done only with the "map" argument, e.g., when --resume loads a checkpoint
+	 */
+	bool map_weights(const std::string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) std::exit(-1);
+		struct stat st;
+		size_t bytes = fstat(fd, &st) == 0 ? st.st_size : 0;
+		void* mem = bytes ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (mem == MAP_FAILED) return false;
+		std::shared_ptr<char> file(static_cast<char*>(mem), [bytes](char* p) { munmap(p, bytes); });
+		char* at = file.get(), * end = at + bytes;
+		uint32_t num = 0;
+		if (size_t(end - at) < sizeof(num)) return false;
+		std::memcpy(&num, at, sizeof(num));
+		at += sizeof(num);
+		std::vector<weight> tables;
+		for (uint32_t i = 0; i < num; i++) {
+			uint64_t size = 0;
+			if (size_t(end - at) < sizeof(size)) return false;
+			std::memcpy(&size, at, sizeof(size));
+			at += sizeof(size);
+			if (size & weight::sparse_flag || size_t(end - at) / sizeof(weight::type) < size) return false;
+			tables.emplace_back(file, reinterpret_cast<weight::type*>(at), size);
+			at += sizeof(weight::type) * size;
+		}
+		load_trailers(at, end);
+		net = tables;
+		return true;
+	}
+	/**
+	 * write the weights aside and rename, so that the file is replaced atomically and
+	 * a mapping of the previous file (see map_weights) stays valid
+	 *
+	 * a network with its own alphabet is followed by the magic "TAB1" and the symbol of each tile,
+	 * and a network with its own layout is followed by the magic "TLO1", the number of tables,
+	 * and the length and the cell order of each table
+	 *
+	 * sparse tables which ran out of room are reported with the updates they lost
+	 */
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		for (size_t i = 0; i < net.size(); i++) {
+			if (net[i].spills()) std::cerr << "sparse: table " << i << " is full, " << net[i].spills() << " updates spilled" << std::endl;
+		}
+		std::ofstream out(path + ".tmp", std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open()) std::exit(-1);
 		uint32_t size = net.size();
 		out.write(reinterpret_cast<char*>(&size), sizeof(size));
 		for (weight& w : net) out << w;
+		if (!plain_alphabet()) {
+			out.write("TAB1", 4);
+			out.write(reinterpret_cast<const char*>(alphabet.data()), alphabet.size());
+		}
+		if (layout.size()) {
+			uint32_t num = layout.size();
+			out.write("TLO1", 4);
+			out.write(reinterpret_cast<const char*>(&num), sizeof(num));
+			for (const auto& order : layout) {
+				out.put(char(order.size()));
+				out.write(reinterpret_cast<const char*>(order.data()), order.size());
+			}
+		}
 		out.close();
+		if (!out || std::rename((path + ".tmp").c_str(), path.c_str()) != 0) std::exit(-1);
 	}
 
 protected:
 	std::vector<weight> net;
 	float alpha;
+	numa::placement placement;
+	mutable std::map<size_t, std::vector<weight>> replicas;
+	mutable std::mutex replica_mutex;
+	std::array<uint8_t, 16> alphabet; // the symbol of each tile in tuple indices
+	std::vector<std::vector<uint8_t>> layout; // the tuple cell of each digit of the indices of each table, from the lowest
 };
 
 class four_tuple_agent : public weight_agent{
@@ -128,59 +318,40 @@ public:
 		//test
 		//std::cout << "size of weights: " << net.size() << " " << net[0].size() << " " << net[0][0] << std::endl;
 		//std::cout << net_index(1,1,1,1) << std::endl;
+		index_alphabet();
+	}
+
+	virtual void share_weights(const weight_agent& src, size_t node = 0) {
+		weight_agent::share_weights(src, node);
+		index_alphabet();
 	}
 
 	virtual void open_episode(const std::string& flag = "") {
 		//reset private data members
-		episode_boards.clear();
-		episode_rewards.clear();
-		episode_values.clear();
+		episode.clear();
 	}
 
 	virtual void close_episode(const std::string& flag = "") {
-		//start training our agent
-		episode_rewards.push_back(0);
-		episode_values.push_back(0);
-		int len = episode_boards.size();
-		//printf("episode_boards length = %lu, episode_rewards length = %lu, episode_values length = %lu\n", episode_boards.size(),episode_rewards.size(),episode_values.size());
-		/*
-		actual episode length = n
-		episode_boards size = n
-		episode_rewards size = n+1
-		episode_values size = n+1
-		*/
-		for(int i = len-1;i >= 0;i--){
-			double update_value =  alpha * (episode_values[i+1] + episode_rewards[i+1] - episode_values[i]);
-			//update_net
-			//printf("update value before enter function = %lf\n",update_value);
-			update_net(episode_boards[i], update_value);
-			//printf("reward = %d, state value = %d, i = %d\n",episode_rewards[i+1], episode_values[i+1], i);
-			/*
-			printf("=====board being update=====\n");
-			for(int j=0;j<4;j++){
-				for(int k=0;k<4;k++){
-					printf("%d ", episode_boards[i][j][k]);
-				}
-				printf("\n");
-			}
-			*/
+		//start training our agent, backward from the last afterstate whose target is 0
+		for(size_t i = episode.size(); i-- > 0; ){
+			double target = i + 1 < episode.size() ? episode.value(i+1) + episode.reward(i+1) : 0;
+			update_net(episode.index(i), alpha * (target - episode.value(i)));
 		}
 	}
 
-	void update_net(board& b, double update_value){
-		int index_base, index;
-		//printf("update value : %lf\n", update_value);
+	void update_net(const int* index, double update_value){
+		for(int k=0;k<8;k++){
+			net[k][index[k]] += update_value;
+		}
+	}
 
+	/**
+	 * the tuple indices of a board, i.e., the 4 rows followed by the 4 columns
+	 */
+	void features(const board& b, int* index) const {
 		for(int i=0;i<4;i++){
-			index_base = 4*i;
-			//update the tuple at row i
-			index = net_index(b(index_base), b(index_base+1), b(index_base+2), b(index_base+3));
-			net[i][index] += update_value;
-			//printf("updating %d %d, value = %lf\n",i,index,net[i][index]);
-
-			//update the tuple at column i
-			index = net_index(b(i+0), b(i+4), b(i+8), b(i+12));
-			net[i+4][index] += update_value;
+			index[i] = net_index(b(4*i), b(4*i+1), b(4*i+2), b(4*i+3));
+			index[i+4] = net_index(b(i+0), b(i+4), b(i+8), b(i+12));
 		}
 	}
 
@@ -230,10 +401,8 @@ public:
 			//if(reward!=after_state_value) printf("bingo!\n");
 		}
 		if(best_reward != -1){
-			//store the after board and reward into our vector sothat
-			episode_boards.push_back(best_after);
-			episode_rewards.push_back(best_reward);
-			episode_values.push_back(best_after_state_value);
+			//store the features of the after board, its value, and the reward for training
+			features(best_after, episode.push(best_after_state_value - best_reward, best_reward));
 			//printf("return op = %d\n",best_action);
 			return action::slide(best_action);
 		}
@@ -241,260 +410,452 @@ public:
 	}
 
 	double calculate_state_value(const board& b){
+		const std::vector<weight>& net = this->net; // read-only access, never inserts into sparse tables
 		double state_value = 0;
-		int index_base, index;
-
-		for(int i=0;i<4;i++){
-			index_base = 4*i;
-			//plus the tuple at row i
-			index = net_index(b(index_base), b(index_base+1), b(index_base+2), b(index_base+3));
-			state_value += net[i][index];
-			//plus the tuple at column i
-			index = net_index(b(i+0), b(i+4), b(i+8), b(i+12));
-			state_value += net[4+i][index];
+		int index[8];
+		features(b, index);
+		for(int k=0;k<8;k++){
+			state_value += net[k][index[k]];
 		}
 
 		return state_value;
 	}
 
-	int net_index(int index0, int index1, int index2, int index3){
-		return index0 | (index1 << 4) | (index2 << 8) | (index3 << 12); 
+	/**
+	 * the index of 4 tiles, i.e., a number of their symbols in the radix of the alphabet
+	 */
+	int net_index(int index0, int index1, int index2, int index3) const {
+		return alphabet[index0] + radix_base * (alphabet[index1] + radix_base * (alphabet[index2] + radix_base * alphabet[index3]));
+	}
+
+private:
+	/**
+	 * take the radix of the alphabet, whose indices the tables must be able to hold
+	 */
+	void index_alphabet(){
+		radix_base = radix();
+		size_t need = radix_base * radix_base * radix_base * radix_base;
+		for(size_t k=0;k<net.size() && k<8;k++){
+			if(net[k].size() < need) std::exit(-1); // the table cannot hold the indices of the alphabet
+		}
 	}
 
 private:
-	std::vector<board> episode_boards;
-	std::vector<int> episode_values;
-	std::vector<int> episode_rewards;
+	trajectory<8> episode;
 	std::array<int, 4> opcode;
+	unsigned radix_base;
 
 };
 
 class six_tuple_agent : public weight_agent{
+public:
+	/**
+	 * a legal move of the slider, its afterstate, and the value of the afterstate
+	 */
+	struct candidate {
+		board after;
+		board::reward reward;
+		int op;
+		double value;
+	};
+
+	static constexpr size_t num_features = 32; // 4 tuples in 8 isomorphisms
+
+	/**
+	 * the tuple indices of a board, and optionally the sum of their weights, which are kept
+	 * up to date by update() as tiles are placed or slid instead of being recomputed
+	 */
+	struct feature_state {
+		int index[num_features];
+		double value;
+	};
+
 public:
 	six_tuple_agent(const std::string& args = "") : weight_agent(args),opcode({ 0, 1, 2, 3 }) {
 		//test
 		//std::cout << "size of weights: " << net.size() << " " << net[0].size() << " " << net[0][0] << std::endl;
 		//std::cout << net_index(1,1,1,1) << std::endl;
-		alpha = 0.1/32;
+		if (meta.find("alpha") == meta.end())
+			alpha = 0.1/32;
+		if (meta.find("book") != meta.end()) {
+			book = std::make_shared<opening_book>();
+			if (!book->load(meta["book"])) std::exit(-1);
+		}
+		if (meta.find("merge") != meta.end())
+			merge_every = int(meta["merge"]);
+		if (meta.find("cache") != meta.end()) // e.g., "cache=65536" afterstate values
+			cache.reset(new transposition_table(size_t(meta["cache"])));
 		//initialize tuple index
 		tuple_index[0] = {0,1,2,3,4,5};
 		tuple_index[1] = {4,5,6,7,8,9};
 		tuple_index[2] = {5,6,7,9,10,11};
 		tuple_index[3] = {9,10,11,13,14,15};
+		//find the cells read by each tuple in each isomorphism, by transforming a board of cell numbers
+		board iso;
+		for(int i=0;i<16;i++) iso(i) = i;
+		for(int k=0;k<8;k++){
+			if(k == 4){
+				for(int i=0;i<16;i++) iso(i) = i;
+				iso.reflect_horizontal();
+			}else if(k != 0){
+				iso.rotate_clockwise();
+			}
+			for(int p=0;p<16;p++) iso_map[k][p] = iso(p);
+			for(int i=0;i<4;i++){
+				for(int j=0;j<6;j++){
+					iso_cells[k*4+i][j] = iso(tuple_index[i][j]);
+				}
+			}
+		}
+		index_layout();
 		//printf("initialization done\n");
 	}
 
+	virtual void share_weights(const weight_agent& src, size_t node = 0) {
+		weight_agent::share_weights(src, node);
+		index_layout();
+		invalidate();
+		auto from = dynamic_cast<const six_tuple_agent*>(&src);
+		if (from && !book) book = from->book; // the opening book is mapped once and shared like the network
+	}
+
 	virtual void open_episode(const std::string& flag = "") {
 		//reset private data members
-		episode_boards.clear();
-		episode_rewards.clear();
-		episode_values.clear();
+		episode.clear();
+	}
+
+	virtual ~six_tuple_agent() {
+		merge();
 	}
 
 	virtual void close_episode(const std::string& flag = "") {
-		//start training our agent
-		episode_rewards.push_back(0);
-		episode_values.push_back(0);
-		int len = episode_boards.size();
-		//printf("episode_boards length = %lu, episode_rewards length = %lu, episode_values length = %lu\n", episode_boards.size(),episode_rewards.size(),episode_values.size());
-		/*
-		actual episode length = n
-		episode_boards size = n
-		episode_rewards size = n+1
-		episode_values size = n+1
-		*/
-		for(int i = len-1;i >= 0;i--){
-			double update_value =  alpha * (episode_values[i+1] + episode_rewards[i+1] - episode_values[i]);
-			//update_net
-			//printf("update value before enter function = %lf\n",update_value);
-			update_net(episode_boards[i], update_value);
-			//printf("reward = %d, state value = %d, i = %d\n",episode_rewards[i+1], episode_values[i+1], i);
-			/*
-			printf("=====board being update=====\n");
-			for(int j=0;j<4;j++){
-				for(int k=0;k<4;k++){
-					printf("%d ", episode_boards[i][j][k]);
-				}
-				printf("\n");
-			}
-			*/
+		//start training our agent, backward from the last afterstate whose target is 0
+		for(size_t i = episode.size(); i-- > 0; ){
+			double target = i + 1 < episode.size() ? episode.value(i+1) + episode.reward(i+1) : 0;
+			update_net(episode.index(i), alpha * (target - episode.value(i)));
 		}
+		if(!merge_every && alpha != 0 && episode.size()) invalidate();
+		if(merge_every && ++deferred >= merge_every) merge();
 	}
 
-	void update_net(board& b, double update_value){
-		//printf("update value : %lf\n", update_value);
-
-		board  fb = b;
-
-		for(int i=0;i<4;i++){
-			int index = 0;
-			for(int j=0;j<6;j++){
-				index |= fb(tuple_index[i][j]) << (4*j);
+	/**
+	 * update the weights of the indices, or accumulate the update in the private buffer with "merge=N"
+	 */
+	void update_net(const int* index, double update_value){
+		if(merge_every){
+			for(size_t k=0;k<num_features;k++){
+				delta[k % 4][index[k]] += update_value;
 			}
-
-			net[i][index] += update_value;
+			return;
 		}
-
-		for(int k=1;k<=3;k++){
-			fb.rotate_clockwise();
-
-			for(int i=0;i<4;i++){
-				int index = 0;
-				for(int j=0;j<6;j++){
-					index |= fb(tuple_index[i][j]) << (4*j);
-				}
-
-				net[i][index] += update_value;
-			}
+		for(size_t k=0;k<num_features;k++){
+			net[k % 4][index[k]] += update_value;
 		}
+	}
 
-		fb = b;
-		fb.reflect_horizontal();
-		
-		for(int i=0;i<4;i++){
-			int index = 0;
-			for(int j=0;j<6;j++){
-				index |= fb(tuple_index[i][j]) << (4*j);
-			}
+	/**
+	 * the cost of deferred updates: the merges, the entries written by them and their time,
+	 * and the staleness, i.e., the sum over the episodes of the episodes finished by the same
+	 * agent between the episode and the merge of its updates
+	 */
+	struct merge_report {
+		size_t merges;
+		size_t entries;
+		size_t episodes;
+		size_t staleness;
+		double millisec;
+	};
 
-			net[i][index] += update_value;
+	/**
+	 * write the accumulated updates of the last episodes to the tables, table by table
+	 * in index order, so that a hot entry is written once per merge instead of once per update
+	 * and workers sharing the tables touch their cache lines far less often
+	 */
+	void merge(){
+		if(deferred == 0) return;
+		auto start = std::chrono::steady_clock::now();
+		for(size_t t=0;t<4;t++){
+			sorted.assign(delta[t].begin(), delta[t].end());
+			std::sort(sorted.begin(), sorted.end());
+			for(const auto& d : sorted) net[t][d.first] += d.second;
+			report.entries += sorted.size();
+			delta[t].clear();
 		}
+		report.merges++;
+		report.episodes += deferred;
+		report.staleness += deferred * (deferred - 1) / 2;
+		report.millisec += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		deferred = 0;
+		invalidate();
+	}
 
-		for(int k=1;k<=3;k++){
-			fb.rotate_clockwise();
+	const merge_report& merges() const { return report; }
 
-			for(int i=0;i<4;i++){
-				int index = 0;
-				for(int j=0;j<6;j++){
-					index |= fb(tuple_index[i][j]) << (4*j);
-				}
+	/**
+	 * the lookups of afterstate values in the cache of "cache=N", and how many of them hit
+	 */
+	struct cache_report {
+		size_t lookups;
+		size_t hits;
+	};
 
-				net[i][index] += update_value;
-			}
+	cache_report caches() const {
+		std::lock_guard<std::mutex> lock(counter_mutex);
+		cache_report sum = {};
+		for (const auto& c : counters) {
+			sum.lookups += __atomic_load_n(&c->lookups, __ATOMIC_RELAXED);
+			sum.hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
 		}
+		return sum;
+	}
 
+	/**
+	 * drop the cached values, which is done whenever this agent changes the weights, by moving
+	 * to a new generation of keys; weights shared with other agents may still be changed by them
+	 * in the meantime, so the cached values may lag their updates by an episode, like the values
+	 * read by a lookup while the updates of another agent are being written
+	 */
+	void invalidate() {
+		generation++;
+	}
+
+	/**
+	 * the generation of the weights, which moves on whenever this agent changes them
+	 */
+	unsigned weight_generation() const { return generation; }
+
+	/**
+	 * create the kernels of the agent, which is done before main (see below)
+	 */
+	static void register_kernels() {
+		features_kernel();
 	}
 
 	virtual action take_action(const board& b) { 
-		board::reward best_reward = -1;
-		board::reward reward;
-		int best_action = -1;
-		double best_after_state_value = -1000;
-		double best_episode_after_state_value = -1000;
-		board best_after;
-		board after;
+		action move;
+		if (consult(b, move)) return move;
+		candidate list[4];
+		size_t num = expand(b, list);
+		for (size_t i = 0; i < num; i++) list[i].value = calculate_state_value(list[i].after);
+		return select(list, num);
+	}
+
+	/**
+	 * take the move of the opening book if the board is in it, which is stored for training
+	 * with the network value of its afterstate as if the network had chosen it
+	 */
+	bool consult(const board& b, action& move) {
+		unsigned op = 0;
+		const opening_book::entry* e = book && book->size() ? book->find(b, op) : nullptr;
+		if (!e) return false;
+		candidate c;
+		c.after = b;
+		c.reward = c.after.slide(op);
+		if (c.reward == -1) return false;
+		c.op = op;
+		c.value = calculate_state_value(c.after);
+		move = record(c);
+		return true;
+	}
 
+	/**
+	 * list the legal moves and their afterstates, leaving the values to be evaluated,
+	 * so that the values of many boards can be evaluated together
+	 */
+	size_t expand(const board& b, candidate* list) const {
+		size_t num = 0;
 		for(int op:opcode){
-			after = b;
-			reward = after.slide(op);
-			if(reward == -1) continue;
-			double episode_after_state_value = calculate_state_value(after);
-			double after_state_value = episode_after_state_value + reward;
-			/*
-			printf("=====board before=====\n");
-			for(int i=0;i<4;i++){
-				for(int j=0;j<4;j++){
-					printf("%d ", b[i][j]);
-				}
-				printf("\n");
-			}
-			*/
-			/*
-			printf("=====board after=====\n");
-			for(int i=0;i<4;i++){
-				for(int j=0;j<4;j++){
-					printf("%d ", after[i][j]);
-				}
-				printf("\n");
-			}
-			after.rotate_clockwise();
-			printf("=====after rotation=====\n");
-			for(int i=0;i<4;i++){
-				for(int j=0;j<4;j++){
-					printf("%d ", after[i][j]);
-				}
-				printf("\n");
-			}
-			*/
-			if(after_state_value > best_after_state_value || best_reward == -1){
-				//To compare
-				best_after_state_value = after_state_value;
-				//To return the action we choose
-				best_action = op;
-				//To store in the episode_rewards vector
-				best_reward = reward;
-				//To store in the episode_boards vector
-				best_after = after;
-				//To store in the episode_values vector
-				best_episode_after_state_value = episode_after_state_value;
-			}
-			//printf("op:%d\n",op);
-			//printf("reward:%d, after_state_value:%lf\n", reward, after_state_value);
-			//if(reward!=after_state_value) printf("bingo!\n");
+			candidate& c = list[num];
+			c.after = b;
+			c.reward = c.after.slide(op);
+			if(c.reward == -1) continue;
+			c.op = op;
+			c.value = 0;
+			num++;
 		}
-		if(best_reward != -1){
-			//store the after board and reward into our vector sothat
-			episode_boards.push_back(best_after);
-			episode_rewards.push_back(best_reward);
-			episode_values.push_back(best_episode_after_state_value);
-			//printf("return op = %d\n",best_action);
-			return action::slide(best_action);
+		return num;
+	}
+
+	/**
+	 * choose the move with the best reward plus afterstate value, and store it for training
+	 */
+	action select(const candidate* list, size_t num) {
+		const candidate* best = nullptr;
+		for(size_t i = 0; i < num; i++){
+			if(!best || list[i].value + list[i].reward > best->value + best->reward) best = &list[i];
 		}
+		if(best) return record(*best);
 		else return action();
 	}
 
-	double calculate_state_value(const board& b){
-		double state_value = 0;
-		board  fb = b;
+	/**
+	 * store the chosen move for training, where the value is the afterstate value of the network
+	 */
+	action record(const candidate& best) {
+		//store the features of the after board, its value, and the reward for training
+		features(best.after, episode.push(best.value, best.reward));
+		return action::slide(best.op);
+	}
 
-		for(int i=0;i<4;i++){
-			int index = 0;
-			for(int j=0;j<6;j++){
-				index |= fb(tuple_index[i][j]) << (4*j);
-			}
+	/**
+	 * the value of an afterstate, through the cache of "cache=N" if any, which is a lossy table
+	 * keyed by the tiles and the generation of the weights, and may be shared by search threads
+	 */
+	double calculate_state_value(const board& b) const {
+		double value = 0;
+		uint64_t key = 0;
+		if(cache && lookup(b, key, value)) return value;
+		int index[num_features];
+		features(b, index);
+		value = evaluate(index);
+		if(key) cache->store(key, value);
+		return value;
+	}
 
-			state_value += net[i][index];
-		}
+	/**
+	 * the value of an afterstate whose indices are known, e.g., a leaf of a search,
+	 * through the cache if any
+	 */
+	double evaluate(const board& b, const int* index) const {
+		double value = 0;
+		uint64_t key = 0;
+		if(cache && lookup(b, key, value)) return value;
+		value = evaluate(index);
+		if(key) cache->store(key, value);
+		return value;
+	}
 
-		for(int k=1;k<=3;k++){
-			fb.rotate_clockwise();
+	/**
+	 * the indices of all tuples in all isomorphisms, where the k-th one belongs to net[k % 4]
+	 */
+	void features(const board& b, int* index) const {
+		if(packed && extractable) (*features_kernel())(*this, b, index);
+		else if(packed) features_generic(*this, b, index); // a layout that pext cannot extract, whose digits iso_index follows
+		else features_mixed(*this, b, index);
+	}
 
-			for(int i=0;i<4;i++){
-				int index = 0;
-				for(int j=0;j<6;j++){
-					index |= fb(tuple_index[i][j]) << (4*j);
-				}
+	void features(const board& b, feature_state& fs, bool value = true) const {
+		features(b, fs.index);
+		fs.value = value ? evaluate(fs.index) : 0;
+	}
 
-				state_value += net[i][index];
-			}
+	/**
+	 * update the features after the tile at pos has changed, e.g., after board::place
+	 * the value is updated by the weights of the changed tuples only if asked
+	 */
+	void update(feature_state& fs, unsigned pos, board::cell from, board::cell to, bool value = true) const {
+		int diff = int(alphabet[to]) - int(alphabet[from]);
+		for(const std::pair<int, int>& f : cell_features[pos]){
+			int& index = fs.index[f.first];
+			if(value) fs.value -= net[f.first % 4][index];
+			index += diff * f.second;
+			if(value) fs.value += net[f.first % 4][index];
 		}
+	}
 
-		fb = b;
-		fb.reflect_horizontal();
-		
-		for(int i=0;i<4;i++){
-			int index = 0;
-			for(int j=0;j<6;j++){
-				index |= fb(tuple_index[i][j]) << (4*j);
+	/**
+	 * update the features from a board to a related one, e.g., after board::slide,
+	 * where only the tuples covering the changed cells are touched
+	 */
+	void update(feature_state& fs, const board& from, const board& to, bool value = true) const {
+		update(fs, from.pack(), to.pack(), value);
+	}
+	void update(feature_state& fs, board::data from, board::data to, bool value = true) const {
+		int diff[num_features] = { 0 };
+		uint32_t touched = 0;
+		for(board::data changed = from ^ to; changed; ){
+			unsigned pos = __builtin_ctzll(changed) / 4;
+			int cell_diff = int(alphabet[(to >> (4 * pos)) & 0x0f]) - int(alphabet[(from >> (4 * pos)) & 0x0f]);
+			changed &= ~(board::data(0x0f) << (4 * pos));
+			for(const std::pair<int, int>& f : cell_features[pos]){
+				diff[f.first] += cell_diff * f.second;
+				touched |= 1u << f.first;
 			}
+		}
+		for(size_t n=0;n<num_features;n++){
+			if(!(touched & (1u << n))) continue;
+			if(value) fs.value -= net[n % 4][fs.index[n]];
+			fs.index[n] += diff[n];
+			if(value) fs.value += net[n % 4][fs.index[n]];
+		}
+	}
 
-			state_value += net[i][index];
+	/**
+	 * sum up the weights of the given indices, reading the tables without modifying them
+	 */
+	double evaluate(const int* index) const {
+		double state_value = 0;
+		for(size_t k=0;k<num_features;k++){
+			state_value += net[k % 4][index[k]];
 		}
+		return state_value;
+	}
 
-		for(int k=1;k<=3;k++){
-			fb.rotate_clockwise();
+	void prefetch(const int* index) const {
+		for(size_t k=0;k<num_features;k++){
+			net[k % 4].prefetch(index[k]);
+		}
+	}
 
-			for(int i=0;i<4;i++){
-				int index = 0;
-				for(int j=0;j<6;j++){
-					index |= fb(tuple_index[i][j]) << (4*j);
-				}
+	/**
+	 * the tuple cells of the digits of the indices of the i-th table, from the lowest
+	 */
+	std::array<uint8_t, 6> cell_order(size_t i) const {
+		std::array<uint8_t, 6> order;
+		for(int j=0;j<6;j++) order[j] = digit_cell(i, j);
+		return order;
+	}
 
-				state_value += net[i][index];
-			}
+	/**
+	 * the cell orders of the i-th table whose indices pext extracts, i.e., the cells of one of the
+	 * isomorphisms of the tuple in increasing position, see index_layout
+	 */
+	std::vector<std::array<uint8_t, 6>> extractable_orders(size_t i) const {
+		std::vector<std::array<uint8_t, 6>> orders;
+		for(int m=0;m<8;m++){
+			std::array<uint8_t, 6> order = {{ 0, 1, 2, 3, 4, 5 }};
+			const std::array<int, 6>& cells = iso_cells[m*4+i];
+			std::sort(order.begin(), order.end(), [&](uint8_t x, uint8_t y) { return cells[x] < cells[y]; });
+			if(std::find(orders.begin(), orders.end(), order) == orders.end()) orders.push_back(order);
 		}
+		return orders;
+	}
 
-		return state_value;
+	/**
+	 * the symbols of the cells of each feature in the order of the tuple, i.e., independent of the layout
+	 */
+	void symbols(const board& b, std::array<uint8_t, 6>* sym) const {
+		for(size_t n=0;n<num_features;n++){
+			for(int c=0;c<6;c++) sym[n][c] = alphabet[b(iso_cells[n][c])];
+		}
+	}
+
+	/**
+	 * move every weight to the index of a new layout, i.e., the order of the tuple cells of each
+	 * table (from the lowest digit) and a permutation of the symbols; entries that are zero are
+	 * skipped, so that untouched pages of the new tables stay untouched
+	 */
+	void relayout(const std::vector<std::vector<uint8_t>>& order, const std::array<uint8_t, 16>& perm){
+		unsigned base = radix();
+		size_t size = 1;
+		for(int j=0;j<6;j++) size *= base;
+		for(size_t i=0;i<net.size() && i<4;i++){
+			if(net[i].sparse()) std::exit(-1);
+			weight table(net[i].size(), placement);
+			for(size_t from=0;from<size;from++){
+				weight::type w = net[i][from];
+				if(w == 0) continue;
+				uint8_t sym[6];
+				for(int j=0,v=from;j<6;j++,v/=base) sym[digit_cell(i, j)] = v % base;
+				size_t to = 0;
+				for(int j=6;j-- > 0;) to = to * base + perm[sym[order[i][j]]];
+				table[to] = w;
+			}
+			net[i] = table;
+		}
+		layout = order;
+		for(auto& t : alphabet) t = perm[t];
+		index_layout();
 	}
 
 	/*
@@ -504,14 +865,187 @@ public:
 	*/
 
 private:
-	std::vector<board> episode_boards;
-	std::vector<int> episode_values;
-	std::vector<int> episode_rewards;
+	bool lookup(const board& b, uint64_t& key, double& value) const {
+		key = transposition_table::hash(b.pack(), 0, 0, generation);
+		bool hit = cache->find(key, value);
+		cache_counter& c = counter();
+		__atomic_store_n(&c.lookups, c.lookups + 1, __ATOMIC_RELAXED);
+		if(hit) __atomic_store_n(&c.hits, c.hits + 1, __ATOMIC_RELAXED);
+		return hit;
+	}
+
+	/**
+	 * the counts of cache lookups made by one thread, written only by that thread, so that
+	 * search threads do not share a cache line for counting; the padding keeps the counters
+	 * of different threads apart
+	 */
+	struct cache_counter {
+		size_t lookups;
+		size_t hits;
+		std::thread::id owner;
+		char padding[64];
+	};
+
+	/**
+	 * the counter of the calling thread, which is remembered by the thread for the last agent it used
+	 */
+	cache_counter& counter() const {
+		static thread_local size_t agent = 0;
+		static thread_local cache_counter* last = nullptr;
+		if(agent == serial) return *last;
+		std::lock_guard<std::mutex> lock(counter_mutex);
+		std::thread::id self = std::this_thread::get_id();
+		last = nullptr;
+		for(auto& c : counters) if(c->owner == self) last = c.get();
+		if(!last){
+			counters.emplace_back(new cache_counter());
+			counters.back()->owner = self;
+			last = counters.back().get();
+		}
+		agent = serial;
+		return *last;
+	}
+	static size_t next_serial() {
+		static std::atomic<size_t> serials(0);
+		return ++serials;
+	}
+
+	typedef void (*features_fn)(const six_tuple_agent&, const board&, int*);
+	static const cpu::kernel<features_fn>& features_kernel() {
+#if defined(__x86_64__)
+		static const cpu::kernel<features_fn> k("features", features_generic, { { cpu::bmi2, features_bmi2 } });
+#else
+		static const cpu::kernel<features_fn> k("features", features_generic);
+#endif
+		return k;
+	}
+
+	/**
+	 * the tuple cell of the j-th digit of the indices of the i-th table, see the layout of weight_agent
+	 */
+	int digit_cell(size_t i, int j) const {
+		return i < layout.size() && layout[i].size() == 6 ? layout[i][j] : j;
+	}
+
+	/**
+	 * find the cell of each digit of each feature, the features touched by each cell and the place
+	 * value of the cell in their indices, i.e., the tuple indices are mixed-radix numbers of the symbols
+	 * of the cells, in the order of the layout
+	 */
+	void index_layout(){
+		unsigned base = radix();
+		packed = base == 16 && plain_alphabet();
+		radix_base = base;
+		for(size_t n=0;n<num_features;n++){
+			for(int j=0;j<6;j++){
+				iso_index[n][j] = iso_cells[n][digit_cell(n % 4, j)];
+			}
+		}
+		extractable = true;
+		for(int i=0;i<4;i++) extractable = extract_table(i) && extractable;
+		for(auto& f : cell_features) f.clear();
+		for(size_t n=0;n<num_features;n++){
+			for(int j=0,place=1;j<6;j++,place*=base){
+				cell_features[iso_index[n][j]].push_back({ int(n), place });
+			}
+		}
+		size_t need = 1;
+		for(int j=0;j<6;j++) need *= base;
+		for(size_t i=0;i<net.size() && i<4;i++){
+			if(net[i].size() < need) std::exit(-1); // the table cannot hold the indices of the alphabet
+		}
+	}
+
+	/**
+	 * find an isomorphism whose cells are increasing in the order of the digits of the i-th table, so
+	 * that pext on the packed board extracts its indices; pext on the k-th transformed board then
+	 * extracts the feature of another isomorphism, whose slot is kept in pext_slot
+	 */
+	bool extract_table(int i){
+		int m = 0;
+		while(m < 8 && !std::is_sorted(iso_index[m*4+i].begin(), iso_index[m*4+i].end())) m++;
+		if(m == 8) return false;
+		tuple_mask[i] = 0;
+		for(int j=0;j<6;j++) tuple_mask[i] |= board::data(0x0f) << (4*iso_index[m*4+i][j]);
+		uint32_t used = 0;
+		for(int k=0;k<8;k++){
+			for(int s=0;s<8;s++){
+				int n = s*4+i;
+				bool same = !(used & (1u << n));
+				for(int j=0;j<6 && same;j++) same = iso_index[n][j] == iso_map[k][iso_index[m*4+i][j]];
+				if(!same) continue;
+				pext_slot[k][i] = n;
+				used |= 1u << n;
+				break;
+			}
+		}
+		return true;
+	}
+
+	static void features_mixed(const six_tuple_agent& a, const board& b, int* index) {
+		for(size_t n=0;n<num_features;n++){
+			index[n] = 0;
+			for(int j=6;j-- > 0;){
+				index[n] = index[n] * a.radix_base + a.alphabet[b(a.iso_index[n][j])];
+			}
+		}
+	}
+
+	static void features_generic(const six_tuple_agent& a, const board& b, int* index) {
+		for(size_t n=0;n<num_features;n++){
+			index[n] = 0;
+			for(int j=0;j<6;j++){
+				index[n] |= b(a.iso_index[n][j]) << (4*j);
+			}
+		}
+	}
+#if defined(__x86_64__)
+	/**
+	 * transform the packed board as the isomorphisms do, and extract each tuple by pext,
+	 * which keeps the cells in increasing position, i.e., only for the layouts of extract_table
+	 */
+	__attribute__((target("bmi2"))) static void features_bmi2(const six_tuple_agent& a, const board& b, int* index) {
+		board::data v = b.pack(), iso = v;
+		for(int k=0;k<8;k++){
+			if(k == 4) iso = board::reflect_horizontal(v);
+			else if(k != 0) iso = board::rotate_clockwise(iso);
+			for(int i=0;i<4;i++) index[a.pext_slot[k][i]] = _pext_u64(iso, a.tuple_mask[i]);
+		}
+	}
+#endif
+
+private:
+	trajectory<num_features> episode;
 	std::array<int, 4> opcode;
 	std::array<std::array<int, 6>,4> tuple_index;
+	std::array<std::array<int, 6>,num_features> iso_cells; // the cells of each feature, in the order of the tuple
+	std::array<std::array<int, 6>,num_features> iso_index; // the cells of each feature, in the order of the digits
+	std::array<std::array<uint8_t, 16>,8> iso_map; // the cell moved to each cell by each isomorphism
+	std::array<board::data, 4> tuple_mask; // the cells extracted by pext for each table
+	std::array<std::array<uint8_t, 4>,8> pext_slot; // the feature extracted from each transformed board for each table
+	std::array<std::vector<std::pair<int, int>>,16> cell_features; // the features of each cell, and the place value of the cell
+	bool packed; // whether the indices are the tiles of the cells, 4 bits each
+	bool extractable; // whether the digits of every table are the cells of an isomorphism in increasing position, as pext extracts them
+	unsigned radix_base;
+	std::shared_ptr<opening_book> book;
+	size_t merge_every = 0; // the episodes per merge with "merge=N", or 0 to update the tables directly
+	size_t deferred = 0;
+	std::unordered_map<int, double> delta[4];
+	std::vector<std::pair<int, double>> sorted;
+	merge_report report = {};
+	std::unique_ptr<transposition_table> cache; // the afterstate values with "cache=N", see calculate_state_value
+	unsigned generation = 0;
+	mutable std::vector<std::unique_ptr<cache_counter>> counters; // the counters of the threads using the cache
+	mutable std::mutex counter_mutex;
+	const size_t serial = next_serial(); // the identity of the agent for the counters remembered by threads
 
 };
 
+/**
+ * the kernels of six_tuple_agent are registered eagerly as well, see board_kernels_registered
+ */
+static const bool six_tuple_kernels_registered = (six_tuple_agent::register_kernels(), true);
+
 /**
  * default random environment, i.e., placer
  * place the hint tile and decide a new hint tile
@@ -546,10 +1080,232 @@ public:
 		return action();
 	}
 
+public:
+	/**
+	 * a placement which take_action may choose, and its probability
+	 */
+	struct outcome {
+		unsigned pos;
+		board::cell tile;
+		board::cell hint;
+		double prob;
+		action move() const { return action::place(pos, tile, hint); }
+	};
+	static constexpr size_t max_outcomes = 16 * 3 * 3;
+
+	/**
+	 * enumerate every placement of take_action on the afterstate into the given buffer,
+	 * which must hold max_outcomes entries, and return the number of outcomes
+	 *
+	 * the position is uniform over the empty cells of spaces[last()]; the next hint is drawn
+	 * from the bag, and so is the tile itself when there is no hint yet (i.e., the first move)
+	 */
+	size_t outcomes(const board& after, outcome* list) const {
+		const std::vector<int>& space = spaces[after.last()];
+		size_t empty = std::count_if(space.begin(), space.end(), [&](int pos) { return after(pos) == 0; });
+		unsigned total = after.bag(1) + after.bag(2) + after.bag(3);
+		size_t num = 0;
+		if (empty == 0 || total == 0) return 0;
+		for (int pos : space) {
+			if (after(pos) != 0) continue;
+			if (after.hint()) {
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					if (after.bag(hint) == 0) continue;
+					list[num++] = { unsigned(pos), after.hint(), hint, double(after.bag(hint)) / total / empty };
+				}
+				continue;
+			}
+			if (total < 2) continue;
+			for (board::cell tile = 1; tile <= 3; tile++) {
+				if (after.bag(tile) == 0) continue;
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					unsigned left = after.bag(hint) - (hint == tile ? 1 : 0);
+					if (left == 0) continue;
+					double prob = double(after.bag(tile)) / total * left / (total - 1) / empty;
+					list[num++] = { unsigned(pos), tile, hint, prob };
+				}
+			}
+		}
+		return num;
+	}
+
 private:
 	std::vector<int> spaces[5];
 };
 
+/**
+ * expectimax search over the n-tuple network: the slider maximizes, the placer is a chance
+ * node following random_placer, and the leaves are afterstates evaluated by the network
+ *
+ * 'depth' is the number of slider moves searched, i.e., depth=1 plays like six_tuple_agent
+ * with a per-move 'budget' (e.g., budget=5ms), the search deepens iteratively from depth 1
+ * until the deadline (up to 'depth', 16 by default), and plays the best completed depth
+ * the depth reached is recorded in the slide action, see action::slide::depth()
+ *
+ * the root moves and the outcomes of their chance nodes are searched in parallel by
+ * 'thread' workers, which share a lossy transposition table of 'table' chance nodes
+ * training still follows six_tuple_agent, with the network values of the chosen afterstates,
+ * and the table is keyed by the generation of the weights, so values from before an update are not reused
+ */
+class expectimax_slider : public six_tuple_agent {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	expectimax_slider(const std::string& args = "") : six_tuple_agent("name=expectimax role=slider " + args),
+		depth(2), budget(0), aborted(false) {
+		size_t thread = 1, table = 1 << 20;
+		if (meta.find("budget") != meta.end()) {
+			std::string text = meta["budget"]; // in ms by default, or with a unit of s, ms, or us
+			double time = std::stod(text);
+			double unit = text.find("us") != std::string::npos ? 1 : text.find("ms") == std::string::npos && text.find('s') != std::string::npos ? 1e6 : 1e3;
+			budget = clock::duration(std::chrono::microseconds(int64_t(time * unit)));
+			depth = 16;
+		}
+		if (meta.find("depth") != meta.end())
+			depth = std::max(int(meta["depth"]), 1);
+		if (meta.find("thread") != meta.end())
+			thread = meta["thread"];
+		if (meta.find("table") != meta.end())
+			table = meta["table"];
+		tt = transposition_table(table);
+		if (thread > 1) pool.reset(new scheduler(thread));
+	}
+
+	virtual action take_action(const board& before) {
+		action move;
+		if (consult(before, move)) return move;
+		candidate best;
+		double score;
+		int reached = analyze(before, best, score);
+		if (reached == 0) return action();
+		best.value = calculate_state_value(best.after);
+		record(best);
+		return action::slide(best.op, reached);
+	}
+
+	/**
+	 * search a board for the best move and its score (the reward plus the expected value)
+	 * returns the depth reached, or 0 if there is no legal move
+	 */
+	int analyze(const board& before, candidate& move, double& value) {
+		candidate list[4];
+		size_t num = expand(before, list);
+		if (num == 0) return 0;
+
+		double score[4];
+		size_t best = 0;
+		int reached = 0;
+		deadline = clock::now() + budget;
+		for (int d = budget.count() ? 1 : depth; d <= depth; d++) {
+			aborted = false;
+			if (!search(list, num, d, score) && d > 1) break; // depth 1 is always completed
+			best = 0;
+			for (size_t i = 1; i < num; i++) {
+				if (score[i] > score[best]) best = i;
+			}
+			value = score[best];
+			reached = d;
+			if (budget.count() && clock::now() >= deadline) break;
+		}
+		aborted = false;
+		move = list[best];
+		return reached;
+	}
+
+protected:
+	/**
+	 * score the root moves by a search of depth d, return false if the deadline aborts it
+	 */
+	bool search(const candidate* list, size_t num, int d, double* score) {
+		if (d <= 1 || !pool) {
+			for (size_t i = 0; i < num; i++) {
+				board b = list[i].after;
+				feature_state fs;
+				features(b, fs, false);
+				score[i] = list[i].reward + chance(b, fs, d - 1);
+			}
+			return !aborted;
+		}
+		// split the root moves and the outcomes of their chance nodes into tasks
+		size_t outn[4];
+		for (size_t i = 0; i < num; i++) {
+			outn[i] = model.outcomes(list[i].after, outs[i]);
+			for (size_t k = 0; k < outn[i]; k++) {
+				pool->submit([this, list, i, k, d](size_t) {
+					board b = list[i].after;
+					feature_state fs;
+					features(b, fs, false);
+					part[i][k] = outs[i][k].prob * placed(b, fs, outs[i][k], d - 1);
+				});
+			}
+		}
+		pool->wait();
+		if (aborted) return false;
+		for (size_t i = 0; i < num; i++) {
+			double v = 0;
+			for (size_t k = 0; k < outn[i]; k++) v += part[i][k];
+			if (outn[i] == 0) v = calculate_state_value(list[i].after);
+			tt.store(transposition_table::hash(list[i].after, d - 1, weight_generation()), v);
+			score[i] = list[i].reward + v;
+		}
+		return true;
+	}
+
+protected:
+	/**
+	 * the expected value of an afterstate with 'd' slider moves left to search
+	 */
+	double chance(board& b, feature_state& fs, int d) {
+		if (d <= 0) return evaluate(b, fs.index);
+		if (aborted || (budget.count() && clock::now() >= deadline)) return aborted = true, 0;
+		uint64_t key = transposition_table::hash(b, d, weight_generation());
+		double v = 0;
+		if (tt.find(key, v)) return v;
+		random_placer::outcome list[random_placer::max_outcomes];
+		size_t num = model.outcomes(b, list);
+		if (num == 0) return evaluate(b, fs.index);
+		for (size_t k = 0; k < num; k++) v += list[k].prob * placed(b, fs, list[k], d);
+		if (!aborted) tt.store(key, v); // the value of an aborted search is incomplete
+		return v;
+	}
+
+	/**
+	 * the value after the placer takes an outcome, i.e., the best move of the slider
+	 */
+	double placed(board& b, feature_state& fs, const random_placer::outcome& out, int d) {
+		board::undo rec;
+		b.place(out.pos, out.tile, out.hint, rec);
+		update(fs, out.pos, 0, out.tile, false);
+		double best = 0;
+		bool any = false;
+		for (int op = 0; op < 4; op++) {
+			board::undo mv;
+			board::reward reward = b.slide(op, mv);
+			if (reward == -1) continue;
+			feature_state next = fs;
+			update(next, mv.tile, b.pack(), false);
+			double v = reward + chance(b, next, d - 1);
+			b.unmake(mv);
+			best = any ? std::max(best, v) : v;
+			any = true;
+		}
+		update(fs, out.pos, out.tile, 0, false);
+		b.unmake(rec);
+		return best;
+	}
+
+protected:
+	int depth;
+	clock::duration budget;
+	clock::time_point deadline;
+	std::atomic<bool> aborted;
+	random_placer model;
+	transposition_table tt;
+	std::unique_ptr<scheduler> pool;
+	random_placer::outcome outs[4][random_placer::max_outcomes]; // the root chance nodes
+	double part[4][random_placer::max_outcomes];
+};
+
 /**
  * random player, i.e., slider
  * select a legal action randomly
@@ -725,4 +1481,287 @@ private:
 	std::array<int,4> opcode;
 	std::array<std::array<bool, 4>, 4> monotonic_visited;
 
+};
+
+/**
+ * Monte Carlo tree search over slider moves, where placer moves are chance nodes
+ *
+ * each playout descends by UCT at slider nodes and by sampling at chance nodes, and a new
+ * afterstate is evaluated by the network (rollout=value), or by playing to the end with
+ * random moves (rollout=random) or with heuristic_slider (rollout=heuristic)
+ * 'playout' playouts are run per move, split across 'thread' workers sharing the tree,
+ * where a pending visit counts as a zero return (virtual loss) to spread the workers
+ * nodes come from a pool of 'node' entries allocated once and reused by every move
+ * 'explore' scales the exploration term by the mean return of the parent node
+ */
+class mcts_slider : public six_tuple_agent {
+public:
+	mcts_slider(const std::string& args = "") : six_tuple_agent("name=mcts role=slider " + args),
+		playout(1000), explore(1.0), capacity(1 << 20), used(0) {
+		size_t thread = 1;
+		std::string rollout = "value";
+		unsigned seed = 0;
+		if (meta.find("playout") != meta.end())
+			playout = meta["playout"];
+		if (meta.find("explore") != meta.end())
+			explore = meta["explore"];
+		if (meta.find("node") != meta.end())
+			capacity = meta["node"];
+		if (meta.find("thread") != meta.end())
+			thread = std::max(int(meta["thread"]), 1);
+		if (meta.find("rollout") != meta.end())
+			rollout = std::string(meta["rollout"]);
+		if (meta.find("seed") != meta.end())
+			seed = int(meta["seed"]);
+		nodes.reset(new node[capacity]);
+		for (size_t i = 0; i < thread; i++) {
+			std::string salt = "seed=" + std::to_string(seed) + " thread=" + std::to_string(i);
+			contexts.emplace_back(new context(salt));
+			if (rollout == "random") contexts.back()->policy.reset(new random_slider(salt));
+			if (rollout == "heuristic") contexts.back()->policy.reset(new heuristic_slider());
+			contexts.back()->engine.seed(seed + i);
+		}
+		if (thread > 1) pool.reset(new scheduler(thread));
+	}
+
+	virtual void save_state(std::ostream& out) const {
+		for (const auto& ctx : contexts) {
+			ctx->place.save_state(out);
+			if (ctx->policy) ctx->policy->save_state(out);
+			out << ctx->engine << std::endl;
+		}
+	}
+	virtual void load_state(std::istream& in) {
+		for (const auto& ctx : contexts) {
+			ctx->place.load_state(in);
+			if (ctx->policy) ctx->policy->load_state(in);
+			in >> ctx->engine;
+		}
+	}
+
+	virtual action take_action(const board& before) {
+		action move;
+		if (consult(before, move)) return move;
+		candidate list[4];
+		size_t num = expand(before, list);
+		if (num == 0) return action();
+
+		size_t best = 0;
+		if (num > 1) {
+			used = 1;
+			nodes[0].reset(before, 1, 0, 0, false);
+			if (!pool) {
+				for (size_t n = 0; n < playout; n++) simulate(*contexts[0]);
+			} else {
+				for (size_t t = 0; t < contexts.size(); t++) {
+					size_t share = playout / contexts.size() + (t < playout % contexts.size() ? 1 : 0);
+					pool->submit([this, share](size_t i) {
+						for (size_t n = 0; n < share; n++) simulate(*contexts[i]);
+					});
+				}
+				pool->wait();
+			}
+			// play the most visited move
+			const node& root = nodes[0];
+			uint32_t most = 0;
+			unsigned op = list[0].op;
+			for (uint32_t c = root.first; root.state == node::expanded && c < root.first + root.num; c++) {
+				if (nodes[c].visits > most) most = nodes[c].visits, op = nodes[c].op;
+			}
+			while (list[best].op != int(op)) best++;
+		}
+		list[best].value = calculate_state_value(list[best].after);
+		return record(list[best]);
+	}
+
+protected:
+	/**
+	 * a slider node (before state) or a chance node (afterstate) of the search tree
+	 */
+	struct node {
+		enum { unexpanded, expanding, expanded, leaf };
+		board::data tile;
+		board::data attr;
+		double prob; // the probability of reaching a slider node from its chance node
+		board::reward reward; // the reward of reaching a chance node from its slider node
+		unsigned op;
+		bool chance;
+		std::atomic<int> state;
+		uint32_t first, num;
+		std::atomic<uint32_t> visits;
+		std::atomic<uint32_t> pending;
+		std::atomic<double> sum;
+
+		void reset(const board& b, double p, board::reward r, unsigned o, bool c) {
+			tile = b.pack();
+			attr = b.info();
+			prob = p;
+			reward = r;
+			op = o;
+			chance = c;
+			state = unexpanded;
+			first = num = 0;
+			visits = 0;
+			pending = 0;
+			sum = 0;
+		}
+		board state_of() const {
+			board b;
+			b.unpack(tile);
+			b.info(attr);
+			return b;
+		}
+		double mean() const { return visits ? sum / visits : 0; }
+	};
+
+	/**
+	 * the per-worker state of playouts
+	 */
+	struct context {
+		random_placer place;
+		std::unique_ptr<agent> policy;
+		std::default_random_engine engine;
+		std::vector<node*> path;
+		context(const std::string& args) : place(args) {}
+	};
+
+	void simulate(context& ctx) {
+		ctx.path.clear();
+		node* n = &nodes[0];
+		double g = 0;
+		while (true) {
+			ctx.path.push_back(n);
+			if (!grow(*n)) {
+				g = n->chance ? rollout(*n, ctx) : greedy(*n);
+				break;
+			}
+			if (n->chance) {
+				n = &nodes[sample(*n, ctx)];
+				continue;
+			}
+			node& c = nodes[select(*n)];
+			c.pending++;
+			if (c.visits == 0) {
+				ctx.path.push_back(&c);
+				g = rollout(c, ctx);
+				break;
+			}
+			n = &c;
+		}
+		for (size_t i = ctx.path.size(); i-- > 0; ) {
+			node& v = *ctx.path[i];
+			double sum = v.sum.load();
+			while (!v.sum.compare_exchange_weak(sum, sum + g));
+			v.visits++;
+			if (!v.chance) continue;
+			v.pending--;
+			g += v.reward;
+		}
+	}
+
+	/**
+	 * make sure the children of a node exist, return false if it has none (terminal),
+	 * or if the pool is exhausted, so that the node is evaluated as a leaf instead
+	 */
+	bool grow(node& n) {
+		int expect = node::unexpanded;
+		if (n.state.compare_exchange_strong(expect, node::expanding)) {
+			board b = n.state_of();
+			if (n.chance) {
+				random_placer::outcome list[random_placer::max_outcomes];
+				size_t num = model.outcomes(b, list);
+				uint32_t first = used.fetch_add(num);
+				if (num && first + num <= capacity) {
+					for (size_t k = 0; k < num; k++) {
+						board next = b;
+						next.place(list[k].pos, list[k].tile, list[k].hint);
+						nodes[first + k].reset(next, list[k].prob, 0, 0, false);
+					}
+					n.first = first;
+					n.num = num;
+				}
+			} else {
+				board after[4];
+				board::reward reward[4];
+				unsigned ops[4], num = 0;
+				for (unsigned op = 0; op < 4; op++) {
+					after[num] = b;
+					reward[num] = after[num].slide(op);
+					if (reward[num] != -1) ops[num++] = op;
+				}
+				uint32_t first = used.fetch_add(num);
+				if (num && first + num <= capacity) {
+					for (size_t k = 0; k < num; k++) nodes[first + k].reset(after[k], 1, reward[k], ops[k], true);
+					n.first = first;
+					n.num = num;
+				}
+			}
+			n.state = n.num ? node::expanded : node::leaf;
+		}
+		int state;
+		while ((state = n.state.load()) == node::expanding) std::this_thread::yield();
+		return state == node::expanded;
+	}
+
+	uint32_t select(const node& n) const {
+		double scale = std::max(std::abs(n.mean()), 1.0) * explore;
+		uint32_t total = 0;
+		for (uint32_t c = n.first; c < n.first + n.num; c++) total += nodes[c].visits + nodes[c].pending;
+		uint32_t best = n.first;
+		double best_score = 0;
+		for (uint32_t c = n.first; c < n.first + n.num; c++) {
+			const node& child = nodes[c];
+			uint32_t count = child.visits + child.pending;
+			if (count == 0) return c;
+			double score = child.reward + child.sum / count + scale * std::sqrt(std::log(total) / count);
+			if (c == n.first || score > best_score) best = c, best_score = score;
+		}
+		return best;
+	}
+
+	uint32_t sample(const node& n, context& ctx) const {
+		double r = std::uniform_real_distribution<double>(0, 1)(ctx.engine);
+		for (uint32_t c = n.first; c < n.first + n.num - 1; c++) {
+			if ((r -= nodes[c].prob) < 0) return c;
+		}
+		return n.first + n.num - 1;
+	}
+
+	/**
+	 * the return of a new afterstate, by the network or by playing to the end
+	 */
+	double rollout(const node& n, context& ctx) {
+		board b = n.state_of();
+		if (!ctx.policy) return calculate_state_value(b);
+		double total = 0;
+		while (true) {
+			if (ctx.place.take_action(b).apply(b) == -1) break;
+			board::reward reward = ctx.policy->take_action(b).apply(b);
+			if (reward == -1) break;
+			total += reward;
+		}
+		return total;
+	}
+
+	/**
+	 * the value of a slider node which cannot grow, i.e., the best reward plus network value
+	 */
+	double greedy(const node& n) const {
+		board b = n.state_of();
+		candidate list[4];
+		size_t num = expand(b, list);
+		double best = 0;
+		for (size_t i = 0; i < num; i++) best = std::max(best, list[i].reward + calculate_state_value(list[i].after));
+		return best;
+	}
+
+protected:
+	size_t playout;
+	double explore;
+	size_t capacity;
+	std::atomic<uint32_t> used;
+	std::unique_ptr<node[]> nodes;
+	random_placer model;
+	std::vector<std::unique_ptr<context>> contexts;
+	std::unique_ptr<scheduler> pool;
 };
\ No newline at end of file
@@ -13,6 +13,12 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "cpu.h"
 
 /**
  * array-based board for Threes!
@@ -54,7 +60,76 @@ public:
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
 
+	/**
+	 * the tiles packed into 4-bit cells, where cell (i) is the i-th nibble
+	 * tiles never exceed index 15, since sliding stops merging at index 14
+	 */
+	data pack() const {
+		return (*pack_kernel())(begin());
+	}
+	void unpack(data v) {
+		(*unpack_kernel())(begin(), v);
+	}
+
+	/**
+	 * create the kernels of the board, which is done before main (see below)
+	 */
+	static void register_kernels() {
+		pack_kernel();
+		unpack_kernel();
+	}
+
 private:
+	typedef data (*pack_fn)(const cell*);
+	typedef void (*unpack_fn)(cell*, data);
+	static const cpu::kernel<pack_fn>& pack_kernel() {
+#if defined(__x86_64__)
+		static const cpu::kernel<pack_fn> k("pack", pack_generic, { { cpu::sse42, pack_sse42 } });
+#else
+		static const cpu::kernel<pack_fn> k("pack", pack_generic);
+#endif
+		return k;
+	}
+	static const cpu::kernel<unpack_fn>& unpack_kernel() {
+#if defined(__x86_64__)
+		static const cpu::kernel<unpack_fn> k("unpack", unpack_generic, { { cpu::bmi2, unpack_bmi2 } });
+#else
+		static const cpu::kernel<unpack_fn> k("unpack", unpack_generic);
+#endif
+		return k;
+	}
+
+	static data pack_generic(const cell* c) {
+		data v = 0;
+		for (int i = 0; i < 16; i++) v |= data(c[i] & 0x0fu) << (4 * i);
+		return v;
+	}
+	static void unpack_generic(cell* c, data v) {
+		for (int i = 0; i < 16; i++) c[i] = (v >> (4 * i)) & 0x0fu;
+	}
+#if defined(__x86_64__)
+	/**
+	 * narrow the 16 cells to bytes, then join each pair of bytes into one by multiply-add
+	 */
+	__attribute__((target("sse4.2"))) static data pack_sse42(const cell* c) {
+		const __m128i* p = reinterpret_cast<const __m128i*>(c);
+		__m128i lo = _mm_packus_epi32(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1));
+		__m128i hi = _mm_packus_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+		__m128i bytes = _mm_and_si128(_mm_packus_epi16(lo, hi), _mm_set1_epi8(0x0f));
+		__m128i pairs = _mm_maddubs_epi16(bytes, _mm_set1_epi16(0x1001));
+		return _mm_cvtsi128_si64(_mm_packus_epi16(pairs, pairs));
+	}
+	/**
+	 * deposit each byte of the packed tiles into the low nibbles of two adjacent cells
+	 */
+	__attribute__((target("bmi2"))) static void unpack_bmi2(cell* c, data v) {
+		for (int i = 0; i < 8; i++) {
+			uint64_t two = _pdep_u64(v >> (8 * i), 0x0000000f0000000full);
+			std::memcpy(c + 2 * i, &two, sizeof(two));
+		}
+	}
+#endif
+
 	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
 	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
 
@@ -100,6 +175,33 @@ public:
 	bool operator <=(const board& b) const { return !(b < *this); }
 	bool operator >=(const board& b) const { return !(*this < b); }
 
+public:
+	/**
+	 * the record to revert a move, i.e., the packed tiles and the attributes before it,
+	 * which fits in two registers
+	 */
+	struct undo {
+		data tile;
+		data attr;
+	};
+
+	/**
+	 * apply a move and keep the record to revert it with unmake()
+	 * so that a search can walk a tree on one board instead of copying it
+	 */
+	reward place(unsigned pos, cell tile, cell hint_tile, undo& rec) {
+		rec = { pack(), attr };
+		return place(pos, tile, hint_tile);
+	}
+	reward slide(unsigned opcode, undo& rec) {
+		rec = { pack(), attr };
+		return slide(opcode);
+	}
+	void unmake(const undo& rec) {
+		unpack(rec.tile);
+		attr = rec.attr;
+	}
+
 public:
 
 	/**
@@ -211,6 +313,61 @@ public:
 		}
 	}
 
+	/**
+	 * the transformations above on packed tiles (see pack), i.e., on 4-bit cells in one word
+	 */
+	static data transpose(data v) {
+		v = (v & 0xf0f00f0ff0f00f0full) | ((v & 0x0000f0f00000f0f0ull) << 12) | ((v & 0x0f0f00000f0f0000ull) >> 12);
+		v = (v & 0xff00ff0000ff00ffull) | ((v & 0x00ff00ff00000000ull) >> 24) | ((v & 0x00000000ff00ff00ull) << 24);
+		return v;
+	}
+	static data reflect_horizontal(data v) {
+		return ((v & 0x000f000f000f000full) << 12) | ((v & 0x00f000f000f000f0ull) << 4)
+		     | ((v & 0x0f000f000f000f00ull) >> 4) | ((v & 0xf000f000f000f000ull) >> 12);
+	}
+	static data rotate_clockwise(data v) { return reflect_horizontal(transpose(v)); }
+
+	/**
+	 * the direction of a move on the k-th symmetric board (see canonicalize), or the direction
+	 * on the original board of a move on the k-th symmetric board if inverse; others are kept,
+	 * e.g., 4 as the last action after placing
+	 */
+	static unsigned transform_op(unsigned op, unsigned k, bool inverse = false) {
+		if (op >= 4) return op;
+		unsigned r = k % 4;
+		bool mirror = k >= 4;
+		if (inverse) {
+			op = (op + 4 - r) % 4;
+			return mirror ? (4 - op) % 4 : op;
+		}
+		if (mirror) op = (4 - op) % 4;
+		return (op + r) % 4;
+	}
+
+	/**
+	 * transform the board into its canonical form, i.e., the least of its 8 symmetric boards by
+	 * the packed tiles and then the last action, where the k-th board is rotated clockwise k times,
+	 * or reflected horizontally and then rotated clockwise k-4 times; the last action is transformed
+	 * along, since it decides where the next tile is placed, while the hint and the bag are kept
+	 * returns k of the canonical form
+	 */
+	unsigned canonicalize() {
+		data v = pack(), iso = v, best = v;
+		unsigned op = last(), best_op = op, best_k = 0;
+		for (unsigned k = 1; k < 8; k++) {
+			iso = k == 4 ? reflect_horizontal(v) : rotate_clockwise(iso);
+			unsigned iso_op = transform_op(op, k);
+			if (iso < best || (iso == best && iso_op < best_op)) best = iso, best_op = iso_op, best_k = k;
+		}
+		if (best_k) unpack(best), last(best_op);
+		return best_k;
+	}
+	board canonical() const {
+		board b(*this);
+		b.canonicalize();
+		return b;
+	}
+
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		out << "+------------------------+" << std::endl;
@@ -241,3 +398,8 @@ private:
 	grid tile;
 	data attr; // (#3-tile:4-bit) (#2-tile:4-bit) (#1-tile:4-bit) (last_action:4-bit) (hint_tile:4-bit)
 };
+
+/**
+ * the kernels are registered eagerly, so that cpu::enable and cpu::kernels see all of them
+ */
+static const bool board_kernels_registered = (board::register_kernels(), true);
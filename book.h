@@ -0,0 +1,119 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * book.h: Opening book of the slider
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "board.h"
+
+/**
+ * positions met by the slider early in games, with the best move and its value
+ *
+ * a position is keyed by its packed tiles, the hint, and the bag (the last action of a
+ * state before sliding is always the placement); the file is the magic "TBK2", the number
+ * of entries, and the entries sorted by key, which is mapped into memory and searched as is
+ *
+ * the positions are in canonical form (see board::canonicalize), so an entry serves all
+ * 8 symmetric positions, and its move is for the canonical position; books of the older
+ * magic "TBK1" are keyed by the positions as they are
+ */
+class opening_book {
+public:
+	struct entry {
+		uint64_t tile;
+		uint32_t info;
+		uint32_t op;
+		float value;
+		uint32_t reserved;
+
+		bool operator <(const entry& e) const { return tile != e.tile ? tile < e.tile : info < e.info; }
+	};
+
+public:
+	opening_book() : base(nullptr), length(0), table(nullptr), count(0), symmetric(false) {}
+	opening_book(const opening_book&) = delete;
+	opening_book& operator =(const opening_book&) = delete;
+	~opening_book() { if (base) munmap(base, length); }
+
+	bool load(const std::string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) >= header) {
+			void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (mem != MAP_FAILED) {
+				uint64_t num = 0;
+				std::memcpy(&num, static_cast<char*>(mem) + 8, sizeof(num));
+				bool magic = std::memcmp(mem, "TBK1", 4) == 0 || std::memcmp(mem, "TBK2", 4) == 0;
+				if (magic && header + num * sizeof(entry) <= size_t(st.st_size)) {
+					symmetric = std::memcmp(mem, "TBK2", 4) == 0;
+					base = mem;
+					length = st.st_size;
+					table = reinterpret_cast<const entry*>(static_cast<char*>(mem) + header);
+					count = num;
+				} else {
+					munmap(mem, st.st_size);
+				}
+			}
+		}
+		close(fd);
+		return base != nullptr;
+	}
+
+	/**
+	 * find the entry of a position before sliding, or nullptr if it is not in the book,
+	 * and the move of the entry for the position as it is
+	 */
+	const entry* find(const board& b, unsigned& op) const {
+		board key_board = b;
+		unsigned k = symmetric ? key_board.canonicalize() : 0;
+		entry key = { key_board.pack(), info(key_board), 0, 0, 0 };
+		const entry* it = std::lower_bound(table, table + count, key);
+		if (it == table + count || it->tile != key.tile || it->info != key.info) return nullptr;
+		op = board::transform_op(it->op, k, true);
+		return it;
+	}
+
+	size_t size() const { return count; }
+
+	static uint32_t info(const board& b) {
+		return b.info() & 0xfff0f; // the bag and the hint, without the last action
+	}
+
+	/**
+	 * save the entries, whose positions must be in canonical form
+	 */
+	static bool save(const std::string& path, std::vector<entry> entries) {
+		std::sort(entries.begin(), entries.end());
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		uint64_t num = entries.size();
+		out.write("TBK2\0\0\0\0", 8);
+		out.write(reinterpret_cast<const char*>(&num), sizeof(num));
+		out.write(reinterpret_cast<const char*>(entries.data()), sizeof(entry) * num);
+		return bool(out);
+	}
+
+private:
+	static constexpr size_t header = 16;
+
+	void* base;
+	size_t length;
+	const entry* table;
+	size_t count;
+	bool symmetric; // whether the positions are in canonical form
+};
@@ -0,0 +1,139 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * cpu.h: CPU feature detection and dispatch of kernel variants
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <utility>
+#include <initializer_list>
+
+/**
+ * the instruction set extensions detected at startup, and the subset enabled for kernels
+ *
+ * a kernel has a generic implementation and variants requiring some features, compiled with
+ * target attributes so that the program itself needs no -m flags; the last listed variant
+ * whose features are all enabled is used, and every kernel is resolved again by enable(),
+ * e.g., "--cpu=generic" to benchmark the generic implementations
+ */
+class cpu {
+public:
+	enum feature { sse42 = 1, avx2 = 2, avx512 = 4, bmi2 = 8, all = 15 };
+
+	static unsigned detected() {
+		static const unsigned mask = detect();
+		return mask;
+	}
+	static unsigned enabled() { return state().mask; }
+	static bool has(unsigned f) { return (enabled() & f) == f; }
+
+	/**
+	 * enable the detected features among the given ones, e.g., "native", "generic", or "sse4.2,bmi2";
+	 * returns false if a name is unknown
+	 */
+	static bool enable(const std::string& names) {
+		unsigned mask = 0;
+		std::stringstream ss(names);
+		for (std::string name; std::getline(ss, name, ','); ) {
+			unsigned f = parse(name);
+			if (f == -1u) return false;
+			mask |= f;
+		}
+		state().mask = mask & detected();
+		for (dispatch* k : state().kernels) k->resolve();
+		return true;
+	}
+
+	static std::string describe(unsigned mask) {
+		std::string res;
+		const char* names[] = { "sse4.2", "avx2", "avx512", "bmi2" };
+		for (unsigned i = 0; i < 4; i++) {
+			if (mask & (1u << i)) res += (res.size() ? "," : "") + std::string(names[i]);
+		}
+		return res.size() ? res : "generic";
+	}
+
+	/**
+	 * the names of all kernels and their chosen variants, e.g., "pack=sse4.2 unpack=bmi2"
+	 */
+	static std::string kernels() {
+		std::string res;
+		for (dispatch* k : state().kernels) res += (res.size() ? " " : "") + k->name + "=" + describe(k->chosen);
+		return res;
+	}
+
+public:
+	class dispatch {
+	public:
+		dispatch(const std::string& name) : name(name), chosen(0) { state().kernels.push_back(this); }
+		dispatch(const dispatch&) = delete;
+		dispatch& operator =(const dispatch&) = delete;
+		virtual ~dispatch() {}
+		virtual void resolve() = 0;
+	protected:
+		friend class cpu;
+		std::string name;
+		unsigned chosen; // the features required by the chosen variant
+	};
+
+	/**
+	 * a kernel, i.e., a function pointer of type fn chosen from its variants
+	 * kernels are meant to be function-local statics, which live until the program exits,
+	 * created before main by the modules owning them (e.g., board::register_kernels)
+	 */
+	template<typename fn>
+	class kernel : public dispatch {
+	public:
+		kernel(const std::string& name, fn generic, std::initializer_list<std::pair<unsigned, fn>> list = {}) :
+			dispatch(name), impl(generic), variants(1, { 0, generic }) {
+			variants.insert(variants.end(), list.begin(), list.end());
+			resolve();
+		}
+		virtual void resolve() {
+			for (const auto& v : variants) {
+				if (cpu::has(v.first)) impl = v.second, chosen = v.first;
+			}
+		}
+		fn operator *() const { return impl; }
+	private:
+		fn impl;
+		std::vector<std::pair<unsigned, fn>> variants;
+	};
+
+private:
+	struct registry {
+		unsigned mask;
+		std::vector<dispatch*> kernels;
+	};
+	static registry& state() {
+		static registry reg = { detected(), {} };
+		return reg;
+	}
+
+	static unsigned detect() {
+		unsigned mask = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2")) mask |= sse42;
+		if (__builtin_cpu_supports("avx2")) mask |= avx2;
+		if (__builtin_cpu_supports("avx512f")) mask |= avx512;
+		if (__builtin_cpu_supports("bmi2")) mask |= bmi2;
+#endif
+		return mask;
+	}
+	static unsigned parse(const std::string& name) {
+		if (name == "native") return all;
+		if (name == "generic" || name.empty()) return 0;
+		if (name == "sse4.2") return sse42;
+		if (name == "avx2") return avx2;
+		if (name == "avx512") return avx512;
+		if (name == "bmi2") return bmi2;
+		return -1u;
+	}
+};
@@ -21,24 +21,39 @@
 
 class episode {
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	class view;
+
+public:
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0), ep_spent(), ep_timed(true) {}
 
 public:
 	board& state() { return ep_state; }
 	const board& state() const { return ep_state; }
 	board::score score() const { return ep_score; }
 
-	void open_episode(const std::string& tag) {
+	/**
+	 * open the episode, where the time of each move is kept only if timed, otherwise
+	 * only the time spent by each role is, which is enough for the speed in statistics
+	 */
+	void open_episode(const std::string& tag, bool timed = true) {
 		ep_open = { tag, millisec() };
+		ep_timed = timed;
 	}
+	/**
+	 * close the episode and release the spare capacity of its moves, since closed episodes
+	 * are kept by statistics
+	 */
 	void close_episode(const std::string& tag) {
 		ep_close = { tag, millisec() };
+		ep_moves.shrink_to_fit();
+		ep_times.shrink_to_fit();
 	}
 	bool apply_action(action move) {
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		ep_moves.emplace_back(move);
 		ep_score += reward;
+		tally(millisec() - ep_time);
 		return true;
 	}
 	agent& take_turns(agent& slide, agent& place) {
@@ -60,46 +75,41 @@ public:
 	}
 
 	time_t time(unsigned who = -1u) const {
-		time_t time = 0;
-		size_t i = 9;
 		switch (who) {
-		case action::place::type:
-			if (ep_moves.size())
-				for (i = 0; i < 8; i++) time += ep_moves[i].time;
-			// no break;
-		case action::slide::type:
-			while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
-			break;
-		default:
-			time = ep_close.when - ep_open.when;
-			break;
+		case action::slide::type: return ep_spent[1];
+		case action::place::type: return ep_spent[0];
+		default:                  return ep_close.when - ep_open.when;
 		}
-		return time;
 	}
 
-	std::vector<action> actions(unsigned who = -1u) const {
-		std::vector<action> res;
-		size_t i = 9;
+	/**
+	 * the moves of a role, or all moves, iterated in place without copying
+	 * the placer makes the first 9 moves, then the slider and the placer take turns
+	 */
+	view actions(unsigned who = -1u) const {
 		switch (who) {
-		case action::place::type:
-			if (ep_moves.size())
-				for (i = 0; i < 8; i++) res.push_back(ep_moves[i]);
-			// no break;
-		case action::slide::type:
-			while (i < ep_moves.size()) res.push_back(ep_moves[i]), i += 2;
-			break;
-		default:
-			res.assign(ep_moves.begin(), ep_moves.end());
-			break;
+		case action::slide::type: return view(ep_moves.data(), 9, ep_moves.size(), 0, step(who));
+		case action::place::type: return view(ep_moves.data(), 0, ep_moves.size(), 8, step(who));
+		default:                  return view(ep_moves.data(), 0, ep_moves.size(), -1, step(who));
 		}
-		return res;
 	}
 
 public:
 
+	/**
+	 * the rewards are not stored, they are recovered by replaying the moves
+	 */
 	friend std::ostream& operator <<(std::ostream& out, const episode& ep) {
 		out << ep.ep_open << '|';
-		for (const move& mv : ep.ep_moves) out << mv;
+		board b = initial_state();
+		const uint8_t* times = ep.ep_times.data(), * last = times + ep.ep_times.size();
+		for (const move& mv : ep.ep_moves) {
+			board::reward reward = action(mv).apply(b);
+			time_t time = times < last ? time_t(varint(times)) : 0;
+			out << action(mv);
+			if (reward) out << '[' << std::dec << reward << ']';
+			if (time) out << '(' << std::dec << time << ')';
+		}
 		out << '|' << ep.ep_close;
 		return out;
 	}
@@ -110,49 +120,86 @@ public:
 		std::stringstream(token) >> ep.ep_open;
 		std::getline(in, token, '|');
 		for (std::stringstream moves(token); !moves.eof(); moves.peek()) {
-			ep.ep_moves.emplace_back();
-			moves >> ep.ep_moves.back();
-			ep.ep_score += action(ep.ep_moves.back()).apply(ep.ep_state);
+			action code;
+			board::reward reward = 0;
+			time_t time = 0;
+			moves >> code;
+			if (moves.peek() == '[') {
+				moves.ignore(1);
+				moves >> std::dec >> reward;
+				moves.ignore(1);
+			}
+			if (moves.peek() == '(') {
+				moves.ignore(1);
+				moves >> std::dec >> time;
+				moves.ignore(1);
+			}
+			ep.ep_moves.emplace_back(code);
+			ep.ep_score += code.apply(ep.ep_state);
+			ep.tally(time);
 		}
 		std::getline(in, token, '|');
 		std::stringstream(token) >> ep.ep_close;
+		ep.ep_moves.shrink_to_fit();
+		ep.ep_times.shrink_to_fit();
 		return in;
 	}
 
 protected:
 
+	/**
+	 * a move packed into 2 bytes, i.e., the kind in the top 2 bits (1: place, 2: slide)
+	 * and the event of the action in the low 12 bits; other actions are kept as action()
+	 */
 	struct move {
-		action code;
-		//int
-		board::reward reward;
-		time_t time;
-		move(action code = {}, board::reward reward = 0, time_t time = 0) : code(code), reward(reward), time(time) {}
-
-		operator action() const { return code; }
-		friend std::ostream& operator <<(std::ostream& out, const move& m) {
-			out << m.code;
-			if (m.reward) out << '[' << std::dec << m.reward << ']';
-			if (m.time) out << '(' << std::dec << m.time << ')';
-			return out;
-		}
-		friend std::istream& operator >>(std::istream& in, move& m) {
-			in >> m.code;
-			m.reward = 0;
-			m.time = 0;
-			if (in.peek() == '[') {
-				in.ignore(1);
-				in >> std::dec >> m.reward;
-				in.ignore(1);
+		uint16_t code;
+		move(action a = {}) : code(
+			a.type() == action::place::type ? 0x4000 | (a.event() & 0x0fff) :
+			a.type() == action::slide::type ? 0x8000 | (a.event() & 0x0fff) : 0) {}
+
+		operator action() const {
+			switch (code >> 14) {
+			case 1:  return action::place(code & 0x0f, (code >> 4) & 0x0f, (code >> 8) & 0x0f);
+			case 2:  return action::slide(code & 0b11, (code >> 2) & 0xff);
+			default: return action();
 			}
-			if (in.peek() == '(') {
-				in.ignore(1);
-				in >> std::dec >> m.time;
-				in.ignore(1);
-			}
-			return in;
 		}
 	};
 
+public:
+	/**
+	 * a range of moves, which steps by one before the split and by two from the split on
+	 */
+	class view {
+	public:
+		class iterator {
+		public:
+			iterator(const move* base, size_t i, size_t split) : base(base), i(i), split(split) {}
+			const move& operator *() const { return base[i]; }
+			const move* operator ->() const { return base + i; }
+			iterator& operator ++() { i += i < split ? 1 : 2; return *this; }
+			bool operator !=(const iterator& it) const { return i < it.i; }
+		private:
+			const move* base;
+			size_t i;
+			size_t split;
+		};
+
+		view(const move* base, size_t first, size_t last, size_t split, size_t count) :
+			base(base), first(first), last(last), split(split), count(count) {}
+		iterator begin() const { return iterator(base, first, split); }
+		iterator end() const { return iterator(base, last, split); }
+		size_t size() const { return count; }
+
+	private:
+		const move* base;
+		size_t first;
+		size_t last;
+		size_t split;
+		size_t count;
+	};
+
+protected:
 	struct meta {
 		std::string tag;
 		time_t when;
@@ -169,6 +216,26 @@ protected:
 	static board initial_state() {
 		return {};
 	}
+	/**
+	 * add the time of the newest move to its role, i.e., the slider makes the odd moves from the 10th on,
+	 * and keep it as a varint if timed, which takes a byte for the usual moves shorter than 128ms
+	 */
+	void tally(time_t time) {
+		size_t size = ep_moves.size();
+		ep_spent[size >= 10 && size % 2 == 0] += time;
+		if (!ep_timed) return;
+		uint64_t v = uint64_t(time);
+		for (; v >= 0x80; v >>= 7) ep_times.push_back(uint8_t(v | 0x80));
+		ep_times.push_back(uint8_t(v));
+	}
+	static uint64_t varint(const uint8_t*& p) {
+		uint64_t v = 0;
+		for (unsigned shift = 0; ; shift += 7) {
+			uint8_t b = *p++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return v;
+		}
+	}
 	static time_t millisec() {
 		auto now = std::chrono::system_clock::now().time_since_epoch();
 		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
@@ -178,7 +245,10 @@ private:
 	board ep_state;
 	board::score ep_score;
 	std::vector<move> ep_moves;
+	std::vector<uint8_t> ep_times; // the time of each move as a varint
 	time_t ep_time;
+	time_t ep_spent[2]; // the time spent by the placer and the slider
+	bool ep_timed; // whether the time of each move is kept
 
 	meta ep_open;
 	meta ep_close;
@@ -0,0 +1,81 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * golden.h: Golden set of slider decisions for regression checks
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include "board.h"
+
+/**
+ * decisions of a reference build of the slider, replayed against other builds
+ *
+ * an entry is a board before sliding (its tiles, and its hint, bag and last action),
+ * the move chosen by the slider, and the afterstate, reward and network value of each move,
+ * where the reward of an illegal move is -1; values are kept as doubles, so that a replay
+ * can require bit-exact results; the file is the magic "TGS1", the number of entries,
+ * and the entries
+ */
+class golden_set {
+public:
+	struct entry {
+		uint64_t tile;
+		uint64_t info;
+		uint64_t after[4];
+		double value[4];
+		int32_t reward[4];
+		uint32_t op; // 0-3, or 4 if the slider has no move
+		uint32_t reserved;
+
+		board state() const {
+			board b;
+			b.unpack(tile);
+			b.info(info);
+			return b;
+		}
+	};
+
+public:
+	static bool load(const std::string& path, std::vector<entry>& entries) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		char magic[8] = { 0 };
+		uint64_t num = 0;
+		if (!in.read(magic, 8) || std::memcmp(magic, "TGS1", 4) != 0) return false;
+		if (!in.read(reinterpret_cast<char*>(&num), sizeof(num))) return false;
+		entries.resize(num);
+		return bool(in.read(reinterpret_cast<char*>(entries.data()), sizeof(entry) * num));
+	}
+
+	static bool save(const std::string& path, const std::vector<entry>& entries) {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		uint64_t num = entries.size();
+		out.write("TGS1\0\0\0\0", 8);
+		out.write(reinterpret_cast<const char*>(&num), sizeof(num));
+		out.write(reinterpret_cast<const char*>(entries.data()), sizeof(entry) * num);
+		return bool(out);
+	}
+
+	/**
+	 * the fields in which two entries of the same board differ, e.g., "op value[2]",
+	 * or an empty string if they match bit by bit
+	 */
+	static std::string diff(const entry& ref, const entry& now) {
+		std::string res;
+		if (ref.op != now.op) res += " op";
+		for (int i = 0; i < 4; i++) {
+			if (ref.reward[i] != now.reward[i]) res += " reward[" + std::to_string(i) + "]";
+			if (ref.after[i] != now.after[i]) res += " after[" + std::to_string(i) + "]";
+			if (std::memcmp(&ref.value[i], &now.value[i], sizeof(double)) != 0) res += " value[" + std::to_string(i) + "]";
+		}
+		return res.size() ? res.substr(1) : res;
+	}
+};
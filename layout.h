@@ -0,0 +1,139 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * layout.h: Cache-aware layouts of 6-tuple tables
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+/**
+ * choose the order of the cells of each tuple in the indices, and the order of the symbols,
+ * from a trace of the lookups made by evaluations
+ *
+ * weights are 4 bytes, so a cache line holds 16 entries and a page 1024 entries; a lookup is
+ * cheap when it falls on the line (or the page) of the previous lookup of the same feature,
+ * e.g., the afterstates of one board, or the boards of successive moves, so the cells which
+ * change most often between such lookups should take the lowest digits
+ */
+class tuple_layout {
+public:
+	/**
+	 * a lookup of a feature, with the symbols of its cells in the order of the tuple
+	 */
+	struct access {
+		uint8_t feature;
+		std::array<uint8_t, 6> sym;
+	};
+	typedef std::array<uint8_t, 6> order; // the tuple cell of each digit, from the lowest
+	typedef std::array<uint8_t, 16> perm; // the new symbol of each symbol
+
+	/**
+	 * the misses of a set-associative cache of lines and a TLB of pages, simulated over a trace
+	 */
+	struct report {
+		size_t lookups;
+		size_t line_misses;
+		size_t page_misses;
+	};
+
+public:
+	static size_t index(const access& a, const order& ord, const perm& map, unsigned radix) {
+		size_t idx = 0;
+		for (int j = 6; j-- > 0; ) idx = idx * radix + map[a.sym[ord[j]]];
+		return idx;
+	}
+
+	/**
+	 * the order of the cells of the table with the fewest line and page changes between successive
+	 * lookups of the same feature, among the given orders, or among all 720 orders if none is given
+	 */
+	static order best_order(const std::vector<access>& trace, unsigned table, unsigned tables, const perm& map, unsigned radix,
+			std::vector<order> orders = {}) {
+		if (orders.empty()) {
+			order ord = { 0, 1, 2, 3, 4, 5 };
+			do orders.push_back(ord); while (std::next_permutation(ord.begin(), ord.end()));
+		}
+		order best = orders.front();
+		size_t least = -1ull;
+		for (const order& ord : orders) {
+			size_t cost = 0;
+			std::vector<size_t> last(256, -1ull);
+			for (const access& a : trace) {
+				if (a.feature % tables != table) continue;
+				size_t idx = index(a, ord, map, radix), prev = last[a.feature];
+				if (prev != -1ull) cost += ((idx >> 4) != (prev >> 4)) + ((idx >> 10) != (prev >> 10));
+				last[a.feature] = idx;
+			}
+			if (cost < least) least = cost, best = ord;
+		}
+		return best;
+	}
+
+	/**
+	 * the symbols renumbered by their frequency in the trace, so that the common ones are adjacent
+	 */
+	static perm frequent_first(const std::vector<access>& trace, unsigned radix) {
+		std::array<size_t, 16> freq = {};
+		for (const access& a : trace)
+			for (uint8_t s : a.sym) freq[s]++;
+		std::array<uint8_t, 16> rank;
+		std::iota(rank.begin(), rank.end(), 0);
+		std::stable_sort(rank.begin(), rank.begin() + radix, [&](uint8_t x, uint8_t y) { return freq[x] > freq[y]; });
+		perm map;
+		std::iota(map.begin(), map.end(), 0);
+		for (unsigned r = 0; r < radix; r++) map[rank[r]] = r;
+		return map;
+	}
+
+	/**
+	 * simulate a 1MB 8-way cache of 64-byte lines and a 64-entry 4-way TLB of 4KB pages, where
+	 * the tables lie one after another
+	 */
+	static report simulate(const std::vector<access>& trace, unsigned tables, size_t table_size,
+			const std::vector<order>& ord, const perm& map, unsigned radix) {
+		report res = { 0, 0, 0 };
+		way_cache lines(2048, 8), pages(16, 4);
+		for (const access& a : trace) {
+			unsigned t = a.feature % tables;
+			size_t addr = (t * table_size + index(a, ord[t], map, radix)) * 4;
+			res.lookups++;
+			res.line_misses += !lines.touch(addr >> 6);
+			res.page_misses += !pages.touch(addr >> 12);
+		}
+		return res;
+	}
+
+private:
+	/**
+	 * a set-associative cache with LRU replacement, which only tracks the keys it holds
+	 */
+	class way_cache {
+	public:
+		way_cache(size_t sets, size_t ways) : sets(sets), ways(ways), tick(0), key(sets * ways, -1ull), used(sets * ways, 0) {}
+		bool touch(size_t k) {
+			size_t base = (k % sets) * ways, old = base;
+			tick++;
+			for (size_t w = base; w < base + ways; w++) {
+				if (key[w] == k) return used[w] = tick, true;
+				if (used[w] < used[old]) old = w;
+			}
+			key[old] = k;
+			used[old] = tick;
+			return false;
+		}
+	private:
+		size_t sets;
+		size_t ways;
+		size_t tick;
+		std::vector<size_t> key;
+		std::vector<size_t> used;
+	};
+};
@@ -0,0 +1,151 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * numa.h: NUMA topology, thread pinning, and memory placement policies
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * minimal NUMA support via sysfs and raw syscalls, i.e., no libnuma is required
+ * everything degrades to a single node when the topology or the syscalls are unavailable
+ */
+class numa {
+public:
+	enum mode { none = 0, bind = 2, interleave = 3 }; // the values of MPOL_BIND and MPOL_INTERLEAVE
+
+	/**
+	 * where to place an allocation: nowhere in particular, on one node, or across all nodes
+	 */
+	struct placement {
+		int mode;
+		int node;
+		placement(int mode = none, int node = -1) : mode(mode), node(node) {}
+	};
+
+public:
+	static size_t nodes() { return topology().size(); }
+	static int id(size_t n) { return topology()[n].id; }
+	static const std::vector<int>& cpus(size_t n) { return topology()[n].cpus; }
+
+	/**
+	 * pin the calling thread to all cpus of the n-th node
+	 */
+	static bool pin_node(size_t n) {
+		return pin(cpus(n % nodes()));
+	}
+	/**
+	 * pin the calling thread to the i-th cpu, counted node by node
+	 */
+	static bool pin_cpu(size_t i) {
+		std::vector<int> all;
+		for (size_t n = 0; n < nodes(); n++) all.insert(all.end(), cpus(n).begin(), cpus(n).end());
+		return all.size() && pin({ all[i % all.size()] });
+	}
+	/**
+	 * the index of node which owns the i-th cpu, counted node by node
+	 */
+	static size_t node_of_cpu(size_t i) {
+		size_t total = 0;
+		for (size_t n = 0; n < nodes(); n++) total += cpus(n).size();
+		i %= (total ?: 1);
+		for (size_t n = 0; n < nodes(); n++) {
+			if (i < cpus(n).size()) return n;
+			i -= cpus(n).size();
+		}
+		return 0;
+	}
+
+	/**
+	 * allocate zeroed, page-aligned memory, and apply the placement before it is touched
+	 */
+	static void* allocate(size_t bytes, const placement& at = {}) {
+		void* mem = mmap(nullptr, bytes ?: 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) std::exit(-1);
+		if (at.mode != none && nodes() > 1) {
+			std::vector<unsigned long> mask(max_node() / (8 * sizeof(unsigned long)) + 1, 0);
+			for (size_t n = 0; n < nodes(); n++) {
+				if (at.mode == bind && n != size_t(at.node) % nodes()) continue;
+				mask[id(n) / (8 * sizeof(unsigned long))] |= 1ul << (id(n) % (8 * sizeof(unsigned long)));
+			}
+			syscall(SYS_mbind, mem, bytes ?: 1, at.mode, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, 0);
+		}
+		return mem;
+	}
+	static void release(void* mem, size_t bytes) {
+		if (mem) munmap(mem, bytes ?: 1);
+	}
+
+private:
+	struct node {
+		int id;
+		std::vector<int> cpus;
+	};
+
+	static bool pin(const std::vector<int>& list) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : list) CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+
+	static int max_node() {
+		int max = 0;
+		for (const node& n : topology()) max = std::max(max, n.id);
+		return max;
+	}
+
+	static const std::vector<node>& topology() {
+		static const std::vector<node> topo = probe();
+		return topo;
+	}
+
+	static std::vector<node> probe() {
+		std::vector<node> topo;
+		std::ifstream online("/sys/devices/system/node/online");
+		std::string list;
+		if (online >> list) {
+			for (int id : parse(list)) {
+				std::ifstream in("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+				std::string cpus;
+				if (in >> cpus) topo.push_back({ id, parse(cpus) });
+			}
+		}
+		if (topo.empty()) {
+			topo.push_back({ 0, {} });
+			for (unsigned i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); i++) topo[0].cpus.push_back(i);
+		}
+		return topo;
+	}
+
+	/**
+	 * parse a sysfs list such as "0-3,8-11"
+	 */
+	static std::vector<int> parse(const std::string& list) {
+		std::vector<int> res;
+		std::stringstream ss(list);
+		for (std::string range; std::getline(ss, range, ','); ) {
+			if (range.empty()) continue;
+			size_t dash = range.find('-');
+			int lo = std::stoi(range.substr(0, dash));
+			int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+			for (int i = lo; i <= hi; i++) res.push_back(i);
+		}
+		return res;
+	}
+};
@@ -0,0 +1,104 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * perf.h: Hardware performance counters of the calling thread
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/**
+ * cycles, instructions, LLC misses and dTLB misses of the calling thread in user space,
+ * accumulated per phase between begin() and end(), e.g., the moves and the training of the slider
+ *
+ * the counters are opened as one group via perf_event_open, so that they are read together;
+ * counters unavailable on the machine (or in the container) are left out and read as 0,
+ * and begin() and end() do nothing if none of them can be opened
+ */
+class perf_counters {
+public:
+	enum counter { cycles, instructions, llc_misses, dtlb_misses, num_counters };
+	enum phase { act, learn, num_phases };
+
+	/**
+	 * the sums of the counters over the sampled calls of each phase
+	 */
+	struct totals {
+		uint64_t calls[num_phases];
+		uint64_t value[num_phases][num_counters];
+	};
+
+public:
+	perf_counters() : leader(-1), num(0), sum(), from() {
+		const uint64_t cache = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+		const struct { uint32_t type; uint64_t config; } events[num_counters] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache },
+		};
+		for (int c = 0; c < num_counters; c++) {
+			struct perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[c].type;
+			attr.config = events[c].config;
+			attr.disabled = leader < 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fd < 0) continue;
+			if (leader < 0) leader = fd;
+			fds[num] = fd;
+			slot[num++] = c;
+		}
+		if (leader >= 0) ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator =(const perf_counters&) = delete;
+	~perf_counters() { for (int i = 0; i < num; i++) close(fds[i]); }
+
+	bool available() const { return leader >= 0; }
+	bool available(counter c) const {
+		for (int i = 0; i < num; i++) if (slot[i] == c) return true;
+		return false;
+	}
+
+	void begin() {
+		if (leader >= 0) read(from);
+	}
+	void end(phase p) {
+		if (leader < 0) return;
+		uint64_t to[num_counters];
+		read(to);
+		sum.calls[p]++;
+		for (int c = 0; c < num_counters; c++) sum.value[p][c] += to[c] - from[c];
+	}
+
+	const totals& total() const { return sum; }
+
+private:
+	void read(uint64_t* value) {
+		uint64_t buf[1 + num_counters] = { 0 };
+		std::memset(value, 0, sizeof(uint64_t) * num_counters);
+		if (::read(leader, buf, sizeof(buf)) < ssize_t(sizeof(uint64_t))) return;
+		for (int i = 0; i < num && i < int(buf[0]); i++) value[slot[i]] = buf[1 + i];
+	}
+
+private:
+	int leader;
+	int fds[num_counters];
+	int slot[num_counters]; // the counter read by each opened event, in the order of the group
+	int num;
+	totals sum;
+	uint64_t from[num_counters];
+};
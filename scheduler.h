@@ -0,0 +1,151 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * scheduler.h: Work-stealing task scheduler for parallel runners and agents
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+/**
+ * a fixed pool of workers, each with its own task deque
+ *
+ * a worker runs its own tasks last-in-first-out, and an idle worker steals the oldest
+ * task of the others; tasks submitted by a worker go to its own deque, while tasks
+ * submitted from outside are spread round-robin
+ */
+class scheduler {
+public:
+	typedef std::function<void(size_t)> task; // called with the index of the worker
+
+public:
+	/**
+	 * start the workers, the setup is called once by each worker before it runs any task
+	 */
+	scheduler(size_t num, const std::function<void(size_t)>& setup = nullptr) : queues(num), next(0), queued(0), running(0), stop(false) {
+		for (size_t i = 0; i < num; i++) queues[i].reset(new queue);
+		for (size_t i = 0; i < num; i++) workers.emplace_back(&scheduler::work, this, i, setup);
+	}
+	~scheduler() {
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			stop = true;
+		}
+		idle.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+	scheduler(const scheduler&) = delete;
+	scheduler& operator =(const scheduler&) = delete;
+
+public:
+	void submit(const task& t) {
+		size_t i = self() == this ? current() : next++ % queues.size();
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			queued++;
+			running++;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues[i]->mutex);
+			queues[i]->tasks.push_back(t);
+		}
+		idle.notify_one();
+	}
+
+	/**
+	 * block until every submitted task, including those submitted by tasks, has finished
+	 * workers calling wait() keep running tasks instead of blocking
+	 */
+	void wait() {
+		if (self() == this) {
+			while (running.load() > 0) {
+				if (!run_one(current())) std::this_thread::yield();
+			}
+			return;
+		}
+		std::unique_lock<std::mutex> lock(idle_mutex);
+		done.wait(lock, [this]() { return running.load() == 0; });
+	}
+
+	size_t size() const { return queues.size(); }
+
+	/**
+	 * the index of the calling worker, or -1 if it is not a worker
+	 */
+	static size_t current() { return slot().index; }
+
+private:
+	struct queue {
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+	struct identity {
+		scheduler* owner;
+		size_t index;
+	};
+	static identity& slot() { static thread_local identity id = { nullptr, size_t(-1) }; return id; }
+	static scheduler* self() { return slot().owner; }
+
+	bool pop(size_t i, task& t) {
+		std::lock_guard<std::mutex> lock(queues[i]->mutex);
+		if (queues[i]->tasks.empty()) return false;
+		t = std::move(queues[i]->tasks.back());
+		queues[i]->tasks.pop_back();
+		return true;
+	}
+	bool steal(size_t i, task& t) {
+		for (size_t k = 1; k < queues.size(); k++) {
+			queue& victim = *queues[(i + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.tasks.empty()) continue;
+			t = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	bool run_one(size_t i) {
+		task t;
+		if (!pop(i, t) && !steal(i, t)) return false;
+		queued--;
+		t(i);
+		if (--running == 0) {
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			done.notify_all();
+		}
+		return true;
+	}
+
+	void work(size_t i, std::function<void(size_t)> setup) {
+		slot() = { this, i };
+		if (setup) setup(i);
+		while (true) {
+			if (run_one(i)) continue;
+			std::unique_lock<std::mutex> lock(idle_mutex);
+			idle.wait(lock, [this]() { return stop || queued.load() > 0; });
+			if (stop && queued.load() == 0) return;
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next;
+	std::atomic<size_t> queued;
+	std::atomic<size_t> running;
+	bool stop;
+	std::mutex idle_mutex;
+	std::condition_variable idle;
+	std::condition_variable done;
+};
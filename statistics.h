@@ -12,9 +12,12 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <map>
+#include <mutex>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
+#include "perf.h"
 
 class statistics {
 public:
@@ -22,14 +25,18 @@ public:
 	 * the total episodes to run
 	 * the block size of statistics
 	 * the limit of saving records
+	 * whether the records keep the time of each move (see episode::open_episode)
 	 *
 	 * note that total >= limit >= block
 	 */
-	statistics(size_t total, size_t block = 0, size_t limit = 0)
+	statistics(size_t total, size_t block = 0, size_t limit = 0, bool timed = true)
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  timed(timed),
+		  perf(nullptr),
+		  perf_mark() {}
 
 public:
 	/**
@@ -52,10 +59,19 @@ public:
 	 *                                   the average speed of the placer is 955796
 	 * '84.1%': 84.1% of the games reached 24-tiles, i.e., win rate of 24-tile
 	 * '45.3%': 45.3% of the games terminated with 24-tiles as the largest tile
+	 *
+	 * for sliders recording their search depths, the distribution of depths follows, e.g.,
+	 *         depth   3 (12.5%) 4 (80.1%) 5 (7.4%)
+	 *
+	 * with hardware counters attached (see profile), the counters per call of the slider's
+	 * moves and training in the block follow, where unavailable counters are shown as '-', e.g.,
+	 *         act     cycles = 5210, ipc = 1.92, llc = 3.1, dtlb = 0.8
+	 *         learn   cycles = 912040, ipc = 0.61, llc = 2210.4, dtlb = 301.7
 	 */
 	void show(bool tstat = true, size_t blk = 0) const {
 		size_t num = std::min(data.size(), blk ?: block);
 		size_t stat[64] = { 0 };
+		size_t depth[256] = { 0 }, searched = 0;
 		size_t sop = 0, pop = 0, eop = 0;
 		time_t sdu = 0, pdu = 0, edu = 0;
 		board::score sum = 0, max = 0;
@@ -71,6 +87,10 @@ public:
 			sdu += ep.time();
 			pdu += ep.time(action::slide::type);
 			edu += ep.time(action::place::type);
+			for (action move : ep.actions(action::slide::type)) {
+				unsigned d = action::slide(move).depth();
+				if (d) depth[d]++, searched++;
+			}
 		}
 
 		std::ios ff(nullptr);
@@ -85,6 +105,44 @@ public:
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
 
+		if (searched) {
+			std::cout << "\t" "depth" "\t" << std::setprecision(3);
+			for (size_t d = 0, n = 0; d < 256; d++) {
+				if (depth[d] == 0) continue;
+				std::cout << (n++ ? " " : "") << d << " (" << (depth[d] * 100.0 / searched) << "%" ")";
+			}
+			std::cout << std::endl;
+			std::cout.copyfmt(ff);
+		}
+
+		if (perf && perf->available()) {
+			const perf_counters::totals& now = perf->total();
+			const char* phases[] = { "act", "learn" };
+			std::cout << std::fixed;
+			for (int p = 0; p < perf_counters::num_phases; p++) {
+				uint64_t calls = now.calls[p] - perf_mark.calls[p];
+				if (calls == 0) continue;
+				auto per_call = [&](perf_counters::counter c) -> std::string {
+					if (!perf->available(c)) return "-";
+					std::stringstream ss;
+					ss << std::fixed << std::setprecision(c == perf_counters::cycles ? 0 : 1);
+					ss << double(now.value[p][c] - perf_mark.value[p][c]) / calls;
+					return ss.str();
+				};
+				double cyc = now.value[p][perf_counters::cycles] - perf_mark.value[p][perf_counters::cycles];
+				double ins = now.value[p][perf_counters::instructions] - perf_mark.value[p][perf_counters::instructions];
+				std::cout << "\t" << phases[p] << "\t";
+				std::cout << "cycles = " << per_call(perf_counters::cycles) << ", ";
+				std::cout << "ipc = " << std::setprecision(2);
+				if (cyc && perf->available(perf_counters::instructions)) std::cout << (ins / cyc); else std::cout << "-";
+				std::cout << ", ";
+				std::cout << "llc = " << per_call(perf_counters::llc_misses) << ", ";
+				std::cout << "dtlb = " << per_call(perf_counters::dtlb_misses);
+				std::cout << std::endl;
+			}
+			std::cout.copyfmt(ff);
+		}
+
 		if (!tstat) return;
 		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
 			if (stat[t] == 0) continue;
@@ -108,12 +166,34 @@ public:
 	void open_episode(const std::string& flag = "") {
 		if (count++ >= limit) data.pop_front();
 		data.emplace_back();
-		data.back().open_episode(flag);
+		data.back().open_episode(flag, timed);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		if (count % block == 0) show(), mark();
+	}
+
+	/**
+	 * attach the hardware counters sampled by the runner, which are reported per block
+	 */
+	void profile(const perf_counters* counters) {
+		perf = counters;
+		mark();
+	}
+
+	/**
+	 * record an episode finished by a worker thread, where index is its global index
+	 * episodes are recorded in index order, early arrivals wait in a reorder buffer
+	 */
+	void submit(size_t index, episode&& ep) {
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending.emplace(index, std::move(ep));
+		for (auto it = pending.begin(); it != pending.end() && it->first == count; it = pending.erase(it)) {
+			if (count++ >= limit) data.pop_front();
+			data.push_back(std::move(it->second));
+			if (count % block == 0) show(), mark();
+		}
 	}
 
 	episode& at(size_t i) {
@@ -128,6 +208,27 @@ public:
 	size_t step() const {
 		return count;
 	}
+	bool is_timed() const {
+		return timed;
+	}
+	size_t size() const {
+		return data.size();
+	}
+
+	/**
+	 * write and read the episode counter and the kept records, e.g., for a checkpoint of a run
+	 * the records end with an empty line, so that other states can follow
+	 */
+	void save_state(std::ostream& out) const {
+		out << count << std::endl << *this << std::endl;
+	}
+	void load_state(std::istream& in) {
+		size_t num = 0;
+		in >> num >> std::ws;
+		data.clear();
+		in >> *this;
+		count = std::max(num, data.size());
+	}
 
 	friend std::ostream& operator <<(std::ostream& out, const statistics& stat) {
 		for (const episode& rec : stat.data) out << rec << std::endl;
@@ -143,10 +244,20 @@ public:
 		return in;
 	}
 
+private:
+	void mark() {
+		if (perf) perf_mark = perf->total();
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
+	bool timed;
 	std::deque<episode> data;
+	std::map<size_t, episode> pending;
+	const perf_counters* perf;
+	perf_counters::totals perf_mark; // the counters at the start of the block
+	std::mutex pending_mutex;
 };
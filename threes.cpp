@@ -11,20 +11,413 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <array>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <map>
+#include <chrono>
+#include <numeric>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
+#include "numa.h"
+#include "scheduler.h"
+#include "book.h"
+#include "golden.h"
+#include "perf.h"
+#include "layout.h"
+
+/**
+ * let the slider and the placer take turns until the game ends, and return the winner
+ * the moves of the slider are sampled by the hardware counters if given
+ */
+agent& play(episode& game, agent& slide, agent& place, perf_counters* perf = nullptr) {
+	slide.open_episode("~:" + place.name());
+	place.open_episode(slide.name() + ":~");
+	while (true) {
+		agent& who = game.take_turns(slide, place);
+		if (perf && &who == &slide) perf->begin();
+		action move = who.take_action(game.state());
+		if (perf && &who == &slide) perf->end(perf_counters::act);
+//		std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
+		if (game.apply_action(move) != true) break;
+		if (who.check_for_win(game.state())) break;
+	}
+	return game.last_turns(slide, place);
+}
+
+/**
+ * remove the given keys from agent arguments, e.g., to stop workers from loading or saving weights
+ */
+std::string strip(const std::string& args, const std::vector<std::string>& keys) {
+	std::stringstream ss(args);
+	std::string res;
+	for (std::string pair; ss >> pair; ) {
+		if (std::find(keys.begin(), keys.end(), pair.substr(0, pair.find('='))) != keys.end()) continue;
+		res += pair + " ";
+	}
+	return res;
+}
+
+/**
+ * the value of a key in agent arguments, or an empty string if it is absent
+ */
+std::string option(const std::string& args, const std::string& key) {
+	std::stringstream ss(args);
+	std::string value;
+	for (std::string pair; ss >> pair; ) {
+		if (pair.substr(0, pair.find('=')) == key) value = pair.substr(pair.find('=') + 1);
+	}
+	return value;
+}
+
+/**
+ * create the slider, where "search=expectimax" or "search=mcts" searches on top of the network
+ */
+six_tuple_agent* make_slider(const std::string& args) {
+	if (option(args, "search") == "expectimax") return new expectimax_slider(args);
+	if (option(args, "search") == "mcts") return new mcts_slider(args);
+	return new six_tuple_agent(args);
+}
+
+/**
+ * report the lookups of the afterstate value cache of "cache=N" and its hit rate
+ */
+void show_cache(const six_tuple_agent::cache_report& r) {
+	std::ios ff(nullptr);
+	ff.copyfmt(std::cout);
+	std::cout << "cache: " << r.lookups << " lookups, " << r.hits << " hits";
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << " (" << (r.hits * 100.0 / std::max<size_t>(r.lookups, 1)) << "%)" << std::endl << std::endl;
+	std::cout.copyfmt(ff);
+}
+
+/**
+ * a game running as a resumable task on the thread of its runner
+ *
+ * the task suspends when its slider has listed the afterstates to be evaluated, so that
+ * the runner can evaluate the afterstates of many games together before resuming them
+ */
+struct game_task {
+	episode game;
+	six_tuple_agent* slide;
+	agent* place;
+	size_t index;
+	six_tuple_agent::candidate list[4];
+	size_t num;
+	bool suspended;
+	bool timed;
+
+	game_task(six_tuple_agent* slide = nullptr, agent* place = nullptr, bool timed = true) :
+		slide(slide), place(place), index(0), num(0), suspended(false), timed(timed) {}
+
+	void start(size_t idx) {
+		game = {};
+		index = idx;
+		suspended = false;
+		game.open_episode(slide->name() + ":" + place->name(), timed);
+		slide->open_episode("~:" + place->name());
+		place->open_episode(slide->name() + ":~");
+	}
+
+	/**
+	 * run until the slider needs values (return true), or until the game ends (return false)
+	 */
+	bool resume() {
+		if (suspended) {
+			suspended = false;
+			game.take_turns(*slide, *place); // restart the move timer, waiting for the batch is not charged to the move
+			if (!apply(*slide, slide->select(list, num))) return false;
+		}
+		while (true) {
+			agent& who = game.take_turns(*slide, *place);
+			if (&who == slide) {
+				action move;
+				if (slide->consult(game.state(), move)) {
+					if (!apply(who, move)) return false;
+					continue;
+				}
+				num = slide->expand(game.state(), list);
+				if (num == 0) return false;
+				return suspended = true;
+			}
+			if (!apply(who, who.take_action(game.state()))) return false;
+		}
+	}
+
+	bool apply(agent& who, const action& move) {
+		if (game.apply_action(move) != true) return false;
+		if (who.check_for_win(game.state())) return false;
+		return true;
+	}
+};
+
+/**
+ * build an opening book from the recorded games, e.g., "save=opening.bin ply=8 min=4 depth=4"
+ *
+ * the boards met by the slider within its first 'ply' moves in at least 'min' games
+ * are searched by expectimax of 'depth' on the network of the slider, where symmetric
+ * boards are counted together as their canonical form
+ */
+void build_book(statistics& stats, six_tuple_agent& slide, const std::string& slide_args, const std::string& book_args) {
+	auto value = [&](const std::string& key, size_t def) -> size_t {
+		std::string text = option(book_args, key);
+		return text.size() ? std::stoull(text) : def;
+	};
+	std::string path = option(book_args, "save");
+	size_t ply = value("ply", 8), min = value("min", 4), depth = value("depth", 4);
+
+	std::map<std::pair<board::data, board::data>, std::pair<board, size_t>> seen;
+	for (size_t i = 0; i < stats.size(); i++) {
+		board b;
+		size_t moves = 0;
+		for (action move : stats.at(i).actions()) {
+			if (move.type() == action::slide::type) {
+				if (moves++ >= ply) break;
+				board key = b.canonical();
+				auto& rec = seen[{ key.pack(), opening_book::info(key) }];
+				rec.first = key;
+				rec.second++;
+			}
+			if (move.apply(b) == -1) break;
+		}
+	}
+
+	expectimax_slider search(strip(slide_args, { "init", "load", "save", "search", "depth", "budget", "book" }) + " depth=" + std::to_string(depth));
+	search.share_weights(slide);
+	std::vector<opening_book::entry> entries;
+	for (const auto& rec : seen) {
+		if (rec.second.second < min) continue;
+		six_tuple_agent::candidate best;
+		double score = 0;
+		if (search.analyze(rec.second.first, best, score) == 0) continue;
+		entries.push_back({ rec.first.first, uint32_t(rec.first.second), uint32_t(best.op), float(score), 0 });
+	}
+	if (!opening_book::save(path, entries)) std::exit(-1);
+	std::cout << "book: " << entries.size() << " of " << seen.size() << " boards saved to " << path << std::endl;
+}
+
+/**
+ * choose a layout of the network of the slider for the lookups made in the recorded games,
+ * e.g., "save=weights.bin evals=20000 remap=1", then move the weights and save them
+ *
+ * the first 'evals' afterstates evaluated by the slider are traced; the cell order of each table
+ * is searched on the trace, and with remap=1 the symbols are renumbered by frequency too
+ *
+ * a network of plain tiles is indexed by pext, so its orders are limited to those pext extracts
+ * and its symbols cannot be renumbered; a network with an alphabet is indexed digit by digit
+ * anyway, so any order and numbering is as fast to index
+ */
+void build_layout(statistics& stats, six_tuple_agent& slide, const std::string& layout_args) {
+	std::string path = option(layout_args, "save"), text = option(layout_args, "evals");
+	size_t evals = text.size() ? std::stoull(text) : 20000;
+	bool remap = option(layout_args, "remap") == "1";
+	bool plain = slide.radix() == 16 && slide.plain_alphabet();
+	if (plain && remap) {
+		std::cerr << "layout: remap=1 needs a network with an alphabet" << std::endl;
+		std::exit(-1);
+	}
+
+	std::vector<tuple_layout::access> trace;
+	std::array<uint8_t, 6> sym[six_tuple_agent::num_features];
+	size_t count = 0;
+	for (size_t i = 0; i < stats.size() && count < evals; i++) {
+		board b;
+		for (action move : stats.at(i).actions()) {
+			if (move.type() == action::slide::type) {
+				six_tuple_agent::candidate list[4];
+				size_t num = slide.expand(b, list);
+				for (size_t k = 0; k < num && count < evals; k++, count++) {
+					slide.symbols(list[k].after, sym);
+					for (size_t n = 0; n < six_tuple_agent::num_features; n++) trace.push_back({ uint8_t(n), sym[n] });
+				}
+			}
+			if (move.apply(b) == -1 || count >= evals) break;
+		}
+	}
+
+	unsigned radix = slide.radix();
+	size_t size = 1;
+	for (int j = 0; j < 6; j++) size *= radix;
+	tuple_layout::perm same, map;
+	std::iota(same.begin(), same.end(), 0);
+	map = remap ? tuple_layout::frequent_first(trace, radix) : same;
+	std::vector<tuple_layout::order> before(4), after(4);
+	std::vector<std::vector<uint8_t>> next(4);
+	for (unsigned i = 0; i < 4; i++) {
+		before[i] = slide.cell_order(i);
+		std::vector<tuple_layout::order> orders;
+		if (plain) orders = slide.extractable_orders(i);
+		after[i] = tuple_layout::best_order(trace, i, 4, map, radix, orders);
+		next[i].assign(after[i].begin(), after[i].end());
+	}
+	tuple_layout::report old = tuple_layout::simulate(trace, 4, size, before, same, radix);
+	tuple_layout::report now = tuple_layout::simulate(trace, 4, size, after, map, radix);
+
+	std::cout << "layout: " << count << " evaluations traced, misses per evaluation (simulated)" << std::endl;
+	std::cout << "\t" "lines" "\t" << (old.line_misses * 1.0 / count) << " -> " << (now.line_misses * 1.0 / count) << std::endl;
+	std::cout << "\t" "pages" "\t" << (old.page_misses * 1.0 / count) << " -> " << (now.page_misses * 1.0 / count) << std::endl;
+	for (unsigned i = 0; i < 4; i++) {
+		std::cout << "\t" "order" << i << "\t";
+		for (int j = 6; j-- > 0; ) std::cout << unsigned(after[i][j]) << (j ? " " : "");
+		std::cout << std::endl;
+	}
+	std::cout << std::endl;
+
+	slide.relayout(next, map);
+	slide.snapshot(path);
+}
+
+/**
+ * the decision of the slider on a board, and the afterstate, reward and network value of each move
+ */
+golden_set::entry probe(six_tuple_agent& slide, const board& b) {
+	golden_set::entry e = {};
+	e.tile = b.pack();
+	e.info = b.info();
+	for (int op = 0; op < 4; op++) e.reward[op] = -1;
+	six_tuple_agent::candidate list[4];
+	size_t num = slide.expand(b, list);
+	for (size_t i = 0; i < num; i++) {
+		e.after[list[i].op] = list[i].after.pack();
+		e.reward[list[i].op] = list[i].reward;
+		e.value[list[i].op] = slide.calculate_state_value(list[i].after);
+	}
+	slide.open_episode(); // drop the move stored for training by take_action
+	action move = slide.take_action(b);
+	e.op = move.type() == action::slide::type ? move.event() & 0b11 : 4;
+	return e;
+}
+
+/**
+ * record or replay a golden set of slider decisions, e.g., "save=golden.bin" or "check=golden.bin"
+ *
+ * saving probes the slider on every board it met in the recorded games; checking probes it on
+ * the boards of the set, 'repeat' times for steadier timing, and reports the entries differing
+ * from the set and the throughput; returns the number of mismatches
+ */
+size_t run_golden(statistics& stats, six_tuple_agent& slide, const std::string& golden_args) {
+	std::string save = option(golden_args, "save"), check = option(golden_args, "check");
+	std::string text = option(golden_args, "repeat");
+	size_t repeat = text.size() ? std::stoull(text) : 1;
+
+	std::vector<golden_set::entry> ref, now;
+	if (check.size() && !golden_set::load(check, ref)) std::exit(-1);
+	if (save.size()) {
+		for (size_t i = 0; i < stats.size(); i++) {
+			board b;
+			for (action move : stats.at(i).actions()) {
+				if (move.type() == action::slide::type) ref.push_back({ b.pack(), b.info() });
+				if (move.apply(b) == -1) break;
+			}
+		}
+	}
+
+	now.resize(ref.size());
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repeat; r++) {
+		for (size_t i = 0; i < ref.size(); i++) now[i] = probe(slide, ref[i].state());
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t mismatch = 0;
+	if (check.size()) {
+		for (size_t i = 0; i < ref.size(); i++) {
+			std::string diff = golden_set::diff(ref[i], now[i]);
+			if (diff.empty()) continue;
+			if (mismatch++ < 10) std::cout << "golden: #" << i << " differs in " << diff << std::endl << ref[i].state();
+		}
+	}
+	if (save.size() && !golden_set::save(save, now)) std::exit(-1);
+	std::cout << "golden: " << now.size() << " decisions " << (check.size() ? "checked" : "saved");
+	if (check.size()) std::cout << ", " << mismatch << " mismatches";
+	if (now.size() && sec > 0) {
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << ", " << std::fixed << std::setprecision(0) << (now.size() * repeat / sec) << " decisions/s";
+		std::cout.copyfmt(ff);
+	}
+	std::cout << std::endl;
+	return mismatch;
+}
+
+/**
+ * the configuration of a run, restored from its checkpoint by --resume
+ */
+struct run_config {
+	size_t total, block, limit;
+	std::string slide_args, place_args;
+};
+
+/**
+ * read the configuration of a checkpoint and the file of its weights,
+ * the agent states are read by load_checkpoint
+ */
+std::ifstream open_checkpoint(const std::string& path, run_config& cfg, std::string& weights) {
+	std::ifstream in(path, std::ios::in);
+	std::string magic;
+	if (!(in >> magic) || magic != "threes-checkpoint") std::exit(-1);
+	in >> cfg.total >> cfg.block >> cfg.limit;
+	in.ignore(-1u, '\n');
+	std::getline(in, cfg.slide_args);
+	std::getline(in, cfg.place_args);
+	std::getline(in, weights);
+	return in;
+}
+
+/**
+ * write a checkpoint of a run: the configuration, the agent states and the statistics to 'path',
+ * and the weights of the slider to 'path.weights.N' after N episodes, whose name is recorded in
+ * the checkpoint; the weights are written first and the checkpoint is renamed into place last,
+ * so that a crash at any point leaves a checkpoint matching its weights, and the weights of the
+ * previous checkpoint are removed only after that
+ */
+void save_checkpoint(const std::string& path, const run_config& cfg, statistics& stats, six_tuple_agent& slide, agent& place) {
+	std::string previous;
+	if (std::ifstream(path).good()) {
+		run_config old;
+		open_checkpoint(path, old, previous);
+	}
+	std::string weights = path + ".weights." + std::to_string(stats.step());
+	slide.merge();
+	slide.snapshot(weights);
+	std::ofstream out(path + ".tmp", std::ios::out | std::ios::trunc);
+	if (!out.is_open()) std::exit(-1);
+	out << "threes-checkpoint" << std::endl;
+	out << cfg.total << " " << cfg.block << " " << cfg.limit << std::endl;
+	out << cfg.slide_args << std::endl << cfg.place_args << std::endl;
+	out << weights << std::endl;
+	slide.save_state(out);
+	place.save_state(out);
+	stats.save_state(out);
+	out.close();
+	if (!out || std::rename((path + ".tmp").c_str(), path.c_str()) != 0) std::exit(-1);
+	if (previous.size() && previous != weights) std::remove(previous.c_str());
+}
+
+void load_checkpoint(std::istream& in, statistics& stats, six_tuple_agent& slide, agent& place) {
+	slide.load_state(in);
+	place.load_state(in);
+	stats.load_state(in);
+	if (!in && !in.eof()) std::exit(-1);
+}
 
 int main(int argc, const char* argv[]) {
 	std::cout << "Threes! Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
-	std::string slide_args, place_args;
-	std::string load_path, save_path;
+	size_t total = 1000, block = 0, limit = 0, thread = 1, batch = 0;
+	bool profile = false, timed = true;
+	std::string slide_args, place_args, pin;
+	std::string load_path, save_path, book_args;
+	std::string checkpoint_path, resume_path, golden_args, cpu_args, layout_args;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		//test
@@ -56,10 +449,62 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("thread")) {
+			thread = std::stoull(next_opt());
+		} else if (match_arg("pin")) {
+			pin = next_opt();
+		} else if (match_arg("batch")) {
+			batch = std::stoull(next_opt());
+		} else if (match_arg("book")) {
+			book_args = next_opt();
+		} else if (match_arg("checkpoint")) {
+			checkpoint_path = next_opt();
+		} else if (match_arg("resume")) {
+			resume_path = next_opt();
+		} else if (match_arg("golden")) {
+			golden_args = next_opt();
+		} else if (match_arg("perf")) {
+			profile = true;
+		} else if (match_arg("timing")) {
+			timed = next_opt() != "0";
+		} else if (match_arg("cpu")) {
+			cpu_args = next_opt();
+		} else if (match_arg("layout")) {
+			layout_args = next_opt();
 		}
 	}
 
-	statistics stats(total, block, limit);
+	/**
+	 * --cpu selects the kernel variants by the enabled features, e.g., --cpu=generic to benchmark
+	 * the generic kernels, otherwise every detected feature is used
+	 */
+	if (cpu_args.size() && !cpu::enable(cpu_args)) {
+		std::exit(-1);
+	}
+
+	/**
+	 * checkpoints need a runner whose games can be replayed exactly, which the parallel runner
+	 * cannot do, since its workers take the games in any order with placers of their own
+	 */
+	if (thread > 1 && (checkpoint_path.size() || resume_path.size())) {
+		std::cerr << "--checkpoint and --resume are not supported with --thread" << std::endl;
+		std::exit(-1);
+	}
+
+	/**
+	 * --resume restores the configuration of the checkpoint, maps its weights (see map_weights)
+	 * and continues from its episode counter with the saved random engines and statistics
+	 */
+	run_config cfg = { total, block, limit, slide_args, place_args };
+	std::ifstream resume;
+	std::string resume_weights;
+	if (resume_path.size()) {
+		resume = open_checkpoint(resume_path, cfg, resume_weights);
+		total = cfg.total, block = cfg.block, limit = cfg.limit;
+		slide_args = cfg.slide_args, place_args = cfg.place_args;
+	}
+
+	statistics stats(total, block, limit, timed);
 
 	if (load_path.size()) {
 		std::ifstream in(load_path, std::ios::in);
@@ -68,27 +513,194 @@ int main(int argc, const char* argv[]) {
 		if (stats.is_finished()) stats.summary();
 	}
 
-	six_tuple_agent slide(slide_args);
+	std::string load_args = resume_path.size() ? strip(slide_args, { "init", "load" }) + " load=" + resume_weights + " map" : slide_args;
+	std::unique_ptr<six_tuple_agent> slider(make_slider(load_args));
+	six_tuple_agent& slide = *slider;
 	random_placer place(place_args);
+	if (resume_path.size()) load_checkpoint(resume, stats, slide, place);
+
+	if (cpu_args.size()) {
+		std::cout << "cpu: " << cpu::describe(cpu::detected()) << " detected, " << cpu::describe(cpu::enabled()) << " enabled";
+		std::cout << " (" << cpu::kernels() << ")" << std::endl << std::endl;
+	}
+
+	size_t checkpointed = -1;
+	if (thread > 1) {
+		/**
+		 * parallel runner: each worker owns a slider sharing the network (and the opening book) of the main slider,
+		 * and a placer with its own random stream; games are split into chunks scheduled
+		 * with work stealing, and finished episodes are recorded in index order
+		 *
+		 * at most 'window' chunks are in flight, a finished chunk schedules the chunk 'window'
+		 * chunks later, which bounds the episodes waiting to be recorded
+		 *
+		 * --pin=node pins workers to nodes round-robin, --pin=core pins workers to cpus,
+		 * and the node of a worker decides which replica it reads with numa=replicate
+		 */
+		size_t base = stats.step();
+		size_t grain = std::max<size_t>((total - base) / (thread * 64), 1);
+		size_t window = thread * 4;
+		std::vector<std::unique_ptr<six_tuple_agent>> slide_workers(thread);
+		std::vector<std::unique_ptr<random_placer>> place_workers(thread);
+		scheduler pool(thread, [&](size_t i) {
+			size_t node = pin == "core" ? numa::node_of_cpu(i) : i % numa::nodes();
+			if (pin == "core") numa::pin_cpu(i);
+			if (pin == "node") numa::pin_node(node);
+			slide_workers[i].reset(make_slider(strip(slide_args, { "init", "load", "save", "book" })));
+			place_workers[i].reset(new random_placer(place_args + " thread=" + std::to_string(i)));
+			slide_workers[i]->share_weights(slide, node);
+		});
+		std::function<void(size_t)> schedule = [&](size_t first) {
+			pool.submit([&, first](size_t i) {
+				agent& slide_worker = *slide_workers[i];
+				agent& place_worker = *place_workers[i];
+				for (size_t index = first; index < std::min(first + grain, total); index++) {
+					episode game;
+					game.open_episode(slide_worker.name() + ":" + place_worker.name(), stats.is_timed());
+					agent& win = play(game, slide_worker, place_worker);
+					game.close_episode(win.name());
+					slide_worker.close_episode(win.name());
+					place_worker.close_episode(win.name());
+					stats.submit(index, std::move(game));
+				}
+				if (first + grain * window < total) schedule(first + grain * window);
+			});
+		};
+		for (size_t k = 0; k < window && base + k * grain < total; k++) schedule(base + k * grain);
+		pool.wait();
+
+		/**
+		 * with "merge=N", workers accumulate their updates and merge them every N episodes;
+		 * the rest is merged here, then the cost and the staleness of merging are reported
+		 */
+		if (option(slide_args, "merge").size()) {
+			six_tuple_agent::merge_report sum = {};
+			for (auto& worker : slide_workers) {
+				worker->merge();
+				const six_tuple_agent::merge_report& r = worker->merges();
+				sum.merges += r.merges, sum.entries += r.entries, sum.episodes += r.episodes;
+				sum.staleness += r.staleness, sum.millisec += r.millisec;
+			}
+			std::ios ff(nullptr);
+			ff.copyfmt(std::cout);
+			std::cout << "merge: " << sum.merges << " merges of " << sum.entries << " entries";
+			std::cout << std::fixed << std::setprecision(3);
+			std::cout << ", " << (sum.millisec / std::max<size_t>(sum.merges, 1)) << "ms per merge";
+			std::cout << ", staleness " << (double(sum.staleness) / std::max<size_t>(sum.episodes, 1)) << " episodes";
+			std::cout << std::endl << std::endl;
+			std::cout.copyfmt(ff);
+		}
+		if (option(slide_args, "cache").size()) {
+			six_tuple_agent::cache_report sum = {};
+			for (auto& worker : slide_workers) {
+				sum.lookups += worker->caches().lookups, sum.hits += worker->caches().hits;
+			}
+			show_cache(sum);
+		}
+	}
+
+	if (batch > 0 && thread <= 1 && option(slide_args, "search").empty()) {
+		/**
+		 * batched runner: 'batch' games are in flight on this thread as resumable tasks
+		 * once every task has suspended, the afterstates of all tasks are indexed and
+		 * prefetched first, then evaluated, which overlaps the latency of weight lookups
+		 * the task sliders share the network and the opening book of the main slider, and
+		 * have no value cache of their own, since the batch evaluates their afterstates
+		 *
+		 * with --checkpoint (or --resume), the games are run in rounds of a block, i.e., the tasks
+		 * drain at the end of every block, which is checkpointed before the next round starts
+		 */
+		size_t index = stats.step();
+		std::vector<std::unique_ptr<six_tuple_agent>> slide_tasks;
+		std::vector<game_task> tasks;
+		for (size_t i = 0; i < batch; i++) {
+			slide_tasks.emplace_back(new six_tuple_agent(strip(slide_args, { "init", "load", "save", "book", "cache" })));
+			slide_tasks.back()->share_weights(slide);
+			tasks.emplace_back(slide_tasks.back().get(), &place, stats.is_timed());
+		}
+		std::vector<std::array<int, six_tuple_agent::num_features>> features(batch * 4);
+		size_t round = checkpoint_path.size() || resume_path.size() ? (block ?: total) : total;
+		while (index < total) {
+			size_t until = std::min(total, (index / round + 1) * round);
+			std::vector<game_task*> active;
+			for (game_task& task : tasks) {
+				if (index >= until) break;
+				task.start(index++);
+				active.push_back(&task);
+			}
+			while (active.size()) {
+				for (size_t i = 0; i < active.size(); ) {
+					game_task& task = *active[i];
+					if (task.resume()) {
+						i++;
+						continue;
+					}
+					agent& win = task.game.last_turns(*task.slide, place);
+					task.game.close_episode(win.name());
+					task.slide->close_episode(win.name());
+					place.close_episode(win.name());
+					stats.submit(task.index, std::move(task.game));
+					if (index < until) {
+						task.start(index++);
+					} else {
+						active[i] = active.back();
+						active.pop_back();
+					}
+				}
+				for (size_t i = 0; i < active.size(); i++) {
+					for (size_t k = 0; k < active[i]->num; k++) {
+						slide.features(active[i]->list[k].after, features[i * 4 + k].data());
+						slide.prefetch(features[i * 4 + k].data());
+					}
+				}
+				for (size_t i = 0; i < active.size(); i++) {
+					for (size_t k = 0; k < active[i]->num; k++) {
+						active[i]->list[k].value = slide.evaluate(features[i * 4 + k].data());
+					}
+				}
+			}
+			if (checkpoint_path.size()) {
+				for (auto& task_slide : slide_tasks) task_slide->merge();
+				save_checkpoint(checkpoint_path, cfg, stats, slide, place);
+				checkpointed = stats.step();
+			}
+		}
+	}
+
+	/**
+	 * --perf samples the hardware counters of this thread around the moves and the training
+	 * of the slider, i.e., only the games of this loop are profiled; the training after the last
+	 * game of a block is reported with the next block
+	 */
+	std::unique_ptr<perf_counters> perf(profile ? new perf_counters() : nullptr);
+	if (perf && !perf->available()) {
+		std::cout << "perf: hardware counters are unavailable" << std::endl << std::endl;
+		perf.reset();
+	}
+	stats.profile(perf.get());
 
 	while (!stats.is_finished()) {
 //		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
-		slide.open_episode("~:" + place.name());
-		place.open_episode(slide.name() + ":~");
-
 		stats.open_episode(slide.name() + ":" + place.name());
 		episode& game = stats.back();
-		while (true) {
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state());
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
-		}
-		agent& win = game.last_turns(slide, place);
+		agent& win = play(game, slide, place, perf.get());
 		stats.close_episode(win.name());
+		if (perf) perf->begin();
 		slide.close_episode(win.name());
+		if (perf) perf->end(perf_counters::learn);
 		place.close_episode(win.name());
+		if (checkpoint_path.size() && stats.step() % (block ?: total) == 0) {
+			save_checkpoint(checkpoint_path, cfg, stats, slide, place);
+			checkpointed = stats.step();
+		}
+	}
+
+	if (checkpoint_path.size() && checkpointed != stats.step()) {
+		save_checkpoint(checkpoint_path, cfg, stats, slide, place);
+	}
+
+	if (option(slide_args, "cache").size() && slide.caches().lookups) {
+		show_cache(slide.caches());
 	}
 
 	if (save_path.size()) {
@@ -97,5 +709,17 @@ int main(int argc, const char* argv[]) {
 		out.close();
 	}
 
+	if (book_args.size()) {
+		build_book(stats, slide, slide_args, book_args);
+	}
+
+	if (layout_args.size()) {
+		build_layout(stats, slide, layout_args);
+	}
+
+	if (golden_args.size() && run_golden(stats, slide, golden_args)) {
+		return 1;
+	}
+
 	return 0;
 }
@@ -0,0 +1,57 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * trajectory.h: Afterstates of an episode kept for TD training
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <algorithm>
+
+/**
+ * the afterstates chosen in an episode, stored as a structure of arrays
+ *
+ * each step keeps the value of the afterstate, the reward of the move, and the 'width'
+ * tuple indices of the afterstate, so that training needs not extract them again
+ * the storage is kept by clear(), i.e., it is allocated once and reused across episodes
+ */
+template<size_t width>
+class trajectory {
+public:
+	trajectory() : count(0) {}
+
+public:
+	void clear() { count = 0; }
+
+	/**
+	 * append a step, and return where to store the tuple indices of its afterstate
+	 */
+	int* push(float value, int reward) {
+		if (count == values.size()) grow();
+		values[count] = value;
+		rewards[count] = reward;
+		return &indices[width * count++];
+	}
+
+	size_t size() const { return count; }
+	float value(size_t i) const { return values[i]; }
+	int reward(size_t i) const { return rewards[i]; }
+	const int* index(size_t i) const { return &indices[width * i]; }
+
+private:
+	void grow() {
+		size_t cap = std::max<size_t>(count * 2, 1024);
+		values.resize(cap);
+		rewards.resize(cap);
+		indices.resize(width * cap);
+	}
+
+private:
+	std::vector<float> values;
+	std::vector<int> rewards;
+	std::vector<int> indices;
+	size_t count;
+};
@@ -0,0 +1,82 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * transposition.h: Lossy hash table of search values shared by threads
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "board.h"
+
+/**
+ * a fixed-size, always-replace table of values keyed by 64-bit hashes
+ *
+ * an entry stores (key ^ value) beside the value, so an entry torn by concurrent
+ * writers fails the check and reads as a miss; no locks are needed
+ */
+class transposition_table {
+public:
+	transposition_table(size_t size = 0) : mask(0) {
+		size_t num = 1;
+		while (num < size) num <<= 1;
+		entries.resize(num);
+		mask = num - 1;
+	}
+
+public:
+	bool find(uint64_t key, double& value) const {
+		const entry& e = entries[key & mask];
+		uint64_t check = __atomic_load_n(&e.check, __ATOMIC_RELAXED);
+		uint64_t bits = __atomic_load_n(&e.value, __ATOMIC_RELAXED);
+		if ((check ^ bits) != key) return false;
+		std::memcpy(&value, &bits, sizeof(value));
+		return true;
+	}
+	void store(uint64_t key, double value) {
+		entry& e = entries[key & mask];
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		__atomic_store_n(&e.check, key ^ bits, __ATOMIC_RELAXED);
+		__atomic_store_n(&e.value, bits, __ATOMIC_RELAXED);
+	}
+	void clear() {
+		std::fill(entries.begin(), entries.end(), entry());
+	}
+	size_t size() const { return entries.size(); }
+
+	/**
+	 * the key of a board with its attributes (hint, last action, and bag), a search depth,
+	 * and the generation of the weights the value is computed from
+	 */
+	static uint64_t hash(board::data tile, board::data attr, unsigned depth, unsigned generation = 0) {
+		uint64_t h = tile * 0x9e3779b97f4a7c15ull;
+		h ^= (attr + (uint64_t(depth) << 32)) * 0xc2b2ae3d27d4eb4full;
+		h ^= generation * 0x94d049bb133111ebull;
+		h ^= h >> 29;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 32;
+		return h ?: 1; // key 0 matches an empty entry
+	}
+	/**
+	 * the key of a board shared by its 8 symmetric boards, see board::canonicalize
+	 */
+	static uint64_t hash(const board& b, unsigned depth, unsigned generation = 0) {
+		board c = b.canonical();
+		return hash(c.pack(), c.info(), depth, generation);
+	}
+
+private:
+	struct entry {
+		uint64_t check;
+		uint64_t value;
+		entry() : check(0), value(0) {}
+	};
+	std::vector<entry> entries;
+	size_t mask;
+};
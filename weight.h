@@ -10,40 +10,277 @@
 #pragma once
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <utility>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "numa.h"
 
+/**
+ * hash-backed sparse lookup table for large tuples
+ *
+ * entries live in 64-byte buckets (5 keys followed by 5 values), found by open addressing
+ * over at most max_probe buckets; a key is stored as (index + 1) in 64 bits so that an
+ * all-zero bucket is empty and every index of an 8-tuple (up to 2^32 - 1) has its own key
+ * insertion claims a key slot with a CAS and is safe to run from concurrent trainers,
+ * while the values themselves are updated without locks like the dense table
+ *
+ * an index whose buckets are all taken spills, i.e., its updates go to a slot private to
+ * the thread and are lost; spills are counted so that a table which is too small shows up
+ */
+class sparse_weight {
+public:
+	typedef float type;
+
+	static constexpr int slots = 5;
+	static constexpr size_t max_probe = 4;
+
+	struct alignas(64) bucket {
+		uint64_t key[slots];
+		type value[slots];
+	};
+
+public:
+	/**
+	 * the nominal size (number of indices) and the capacity (number of entries)
+	 * the capacity is rounded up to a power of two of buckets
+	 */
+	sparse_weight(size_t len, size_t cap, const numa::placement& at = {}) : length(len), mask(0), count(0), spilled(0), table(nullptr) {
+		size_t num = 1;
+		while (num * slots < cap) num <<= 1;
+		table = static_cast<bucket*>(numa::allocate(num * sizeof(bucket), at));
+		mask = num - 1;
+	}
+	/**
+	 * a replica of another table with the given placement
+	 */
+	sparse_weight(const sparse_weight& w, const numa::placement& at) : sparse_weight(w.length, w.capacity(), at) {
+		std::memcpy(table, w.table, (mask + 1) * sizeof(bucket));
+		count = w.entries();
+	}
+	sparse_weight(const sparse_weight&) = delete;
+	sparse_weight& operator =(const sparse_weight&) = delete;
+	~sparse_weight() { numa::release(table, (mask + 1) * sizeof(bucket)); }
+
+	/**
+	 * find or insert the entry of index i
+	 * returns a slot private to the thread if the buckets of i are full, whose value is meaningless
+	 */
+	type& operator[] (size_t i) {
+		uint64_t k = i + 1;
+		for (size_t n = 0, b = hash(k); n < probes(); n++, b = (b + 1) & mask) {
+			bucket& bk = table[b];
+			for (int s = 0; s < slots; s++) {
+				uint64_t cur = __atomic_load_n(&bk.key[s], __ATOMIC_ACQUIRE);
+				if (cur == k) return bk.value[s];
+				if (cur != 0) continue;
+				if (__atomic_compare_exchange_n(&bk.key[s], &cur, k, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					__atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+					return bk.value[s];
+				}
+				if (cur == k) return bk.value[s];
+			}
+		}
+		static thread_local type spill;
+		__atomic_fetch_add(&spilled, 1, __ATOMIC_RELAXED);
+		return spill = 0;
+	}
+	/**
+	 * find the entry of index i without inserting, missing entries read as zero
+	 */
+	const type& operator[] (size_t i) const {
+		static const type zero = 0;
+		uint64_t k = i + 1;
+		for (size_t n = 0, b = hash(k); n < probes(); n++, b = (b + 1) & mask) {
+			const bucket& bk = table[b];
+			for (int s = 0; s < slots; s++) {
+				uint64_t cur = __atomic_load_n(&bk.key[s], __ATOMIC_ACQUIRE);
+				if (cur == k) return bk.value[s];
+				if (cur == 0) return zero;
+			}
+		}
+		return zero;
+	}
+
+	void prefetch(size_t i) const { __builtin_prefetch(table + hash(i + 1)); }
+
+	size_t size() const { return length; }
+	size_t capacity() const { return (mask + 1) * slots; }
+	size_t entries() const { return __atomic_load_n(&count, __ATOMIC_RELAXED); }
+	size_t spills() const { return __atomic_load_n(&spilled, __ATOMIC_RELAXED); }
+
+public:
+	/**
+	 * the entries are written as (index, value) pairs, where the index takes 4 bytes
+	 * unless the nominal size needs more
+	 */
+	friend std::ostream& operator <<(std::ostream& out, const sparse_weight& w) {
+		uint64_t cap = w.capacity(), num = w.entries();
+		out.write(reinterpret_cast<const char*>(&cap), sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(&num), sizeof(uint64_t));
+		for (size_t b = 0; b <= w.mask; b++) {
+			const bucket& bk = w.table[b];
+			for (int s = 0; s < slots; s++) {
+				if (bk.key[s] == 0) continue;
+				uint64_t i = bk.key[s] - 1;
+				out.write(reinterpret_cast<const char*>(&i), w.index_bytes());
+				out.write(reinterpret_cast<const char*>(&bk.value[s]), sizeof(type));
+			}
+		}
+		return out;
+	}
+	friend std::istream& operator >>(std::istream& in, sparse_weight& w) {
+		uint64_t cap = 0, num = 0;
+		in.read(reinterpret_cast<char*>(&cap), sizeof(uint64_t));
+		in.read(reinterpret_cast<char*>(&num), sizeof(uint64_t));
+		for (uint64_t n = 0; n < num && in; n++) {
+			uint64_t i = 0;
+			type v = 0;
+			in.read(reinterpret_cast<char*>(&i), w.index_bytes());
+			in.read(reinterpret_cast<char*>(&v), sizeof(type));
+			w[i] = v;
+		}
+		return in;
+	}
+
+private:
+	size_t hash(uint64_t k) const {
+		uint64_t h = k * 0x9e3779b97f4a7c15ull;
+		return (h >> 32) & mask;
+	}
+	size_t probes() const { return std::min(max_probe, mask + 1); }
+	size_t index_bytes() const { return length > (1ull << 32) ? sizeof(uint64_t) : sizeof(uint32_t); }
+
+	size_t length;
+	size_t mask;
+	size_t count;
+	size_t spilled;
+	bucket* table;
+};
+
+/**
+ * lookup table of n-tuple network, either dense (indexed directly) or sparse (hash-backed)
+ *
+ * a weight is a handle, i.e., copies share the same storage so that agents on different
+ * threads can work on one network; use weight(w, placement) to make an actual replica
+ *
+ * dense tables are anonymous mappings, i.e., untouched entries are read from the zero page
+ * of the kernel and cost no memory, and saving seeks over zero pages so that files get holes
+ *
+ * file format: the dense table is stored as its size followed by all values;
+ * the sparse table sets the highest bit of the size, followed by its capacity,
+ * the number of entries, and the (index, value) pairs
+ */
 class weight {
 public:
 	typedef float type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
+	weight() : value(nullptr), length(0) {}
+	weight(size_t len, const numa::placement& at = {}) : value(nullptr), length(0) { allocate(len, at); }
+	weight(size_t len, size_t cap, const numa::placement& at = {}) : value(nullptr), length(0), table(std::make_shared<sparse_weight>(len, cap, at)) {}
+	weight(const weight& f, const numa::placement& at) : value(nullptr), length(0) {
+		if (f.sparse()) {
+			table = std::make_shared<sparse_weight>(*f.table, at);
+		} else {
+			allocate(f.length, at);
+			std::copy(f.value, f.value + f.length, value);
+		}
+	}
+	/**
+	 * a dense table in memory owned by another object, e.g., a mapped file
+	 */
+	weight(const std::shared_ptr<void>& owner, type* data, size_t len) : store(owner, data), value(data), length(len) {}
+	weight(weight&& f) = default;
 	weight(const weight& f) = default;
 
 	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
-	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	type& operator[] (size_t i) { return table ? (*table)[i] : value[i]; }
+	const type& operator[] (size_t i) const { return table ? static_cast<const sparse_weight&>(*table)[i] : value[i]; }
+	void prefetch(size_t i) const { if (table) table->prefetch(i); else __builtin_prefetch(value + i); }
+	size_t size() const { return table ? table->size() : length; }
+	bool sparse() const { return table != nullptr; }
+	size_t spills() const { return table ? table->spills() : 0; }
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.size();
+		if (w.sparse()) {
+			size |= sparse_flag;
+			out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+			return out << *(w.table);
+		}
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		write_holes(out, reinterpret_cast<const char*>(w.value), sizeof(type) * size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		if (size & sparse_flag) {
+			uint64_t cap = 0;
+			auto pos = in.tellg();
+			in.read(reinterpret_cast<char*>(&cap), sizeof(uint64_t));
+			in.seekg(pos);
+			w = weight();
+			w.table = std::make_shared<sparse_weight>(size & ~sparse_flag, cap);
+			return in >> *(w.table);
+		}
+		w = weight(size);
+		in.read(reinterpret_cast<char*>(w.value), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<type> value;
+	void allocate(size_t len, const numa::placement& at) {
+		size_t bytes = sizeof(type) * len;
+		store.reset(static_cast<type*>(numa::allocate(bytes, at)), [bytes](type* mem) { numa::release(mem, bytes); });
+		value = store.get();
+		length = len;
+	}
+
+	/**
+	 * write the bytes, but seek over the file pages they fill with zeros if the stream can seek,
+	 * which leaves holes in files; the last byte is written anyway to keep the length of the file
+	 */
+	static void write_holes(std::ostream& out, const char* data, size_t bytes) {
+		const size_t page = 4096;
+		std::streamoff pos = out.tellp();
+		bool skipped = false;
+		for (size_t i = 0; i < bytes; ) {
+			size_t n = pos < 0 ? bytes - i : std::min(bytes - i, page - size_t(pos + i) % page);
+			if (n == page && zero(data + i, n)) {
+				if (out.seekp(n, std::ios::cur)) {
+					skipped = true;
+					i += n;
+					continue;
+				}
+				out.clear();
+			}
+			out.write(data + i, n);
+			skipped = false;
+			i += n;
+		}
+		if (skipped) out.seekp(-1, std::ios::cur).put(0);
+	}
+	static bool zero(const char* data, size_t bytes) {
+		uint64_t any = 0;
+		for (size_t i = 0; i < bytes; i += sizeof(uint64_t)) {
+			uint64_t v;
+			std::memcpy(&v, data + i, sizeof(v));
+			any |= v;
+		}
+		return any == 0;
+	}
+
+public:
+	static constexpr uint64_t sparse_flag = 1ull << 63; // the flag of sparse tables in the size
+
+protected:
+	std::shared_ptr<type> store;
+	type* value;
+	size_t length;
+	std::shared_ptr<sparse_weight> table;
 };